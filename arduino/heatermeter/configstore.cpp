@@ -0,0 +1,102 @@
+// HeaterMeter Copyright 2013 Bryan Mayland <bmayland@capnbry.net>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+#include "configstore.h"
+
+unsigned int ConfigStore::copyCrc(const unsigned char *ofs) const
+{
+  unsigned int crc = 0xffff;
+  // The generation is covered too
+  for (unsigned char i=0; i<=_size; ++i)
+    crc = _crc16_update(crc, eeprom_read_byte(ofs++));
+  return crc;
+}
+
+boolean ConfigStore::copyValid(const unsigned char *ofs) const
+{
+  return copyCrc(ofs) == eeprom_read_word((const uint16_t *)(ofs + _size + 1));
+}
+
+boolean ConfigStore::load(void *dst, unsigned char rec)
+{
+  const unsigned char *ofs0 = copyAddr(0, rec);
+  const unsigned char *ofs1 = copyAddr(1, rec);
+  boolean valid0 = copyValid(ofs0);
+  boolean valid1 = copyValid(ofs1);
+  if (!valid0 && !valid1)
+    return false;
+
+  unsigned char gen0 = eeprom_read_byte(ofs0 + _size);
+  unsigned char gen1 = eeprom_read_byte(ofs1 + _size);
+  // Generations only ever differ by one, the wrapping difference says
+  // which is newer
+  if (valid0 && (!valid1 || (signed char)(gen0 - gen1) > 0))
+  {
+    _active &= ~(1 << rec);
+    eeprom_read_block(dst, ofs0, _size);
+  }
+  else
+  {
+    _active |= 1 << rec;
+    eeprom_read_block(dst, ofs1, _size);
+  }
+  return true;
+}
+
+void ConfigStore::storeAll(const void *src, unsigned char rec)
+{
+  unsigned char idx = 2;
+  while (idx-- > 0)
+  {
+    unsigned char *ofs = (unsigned char *)copyAddr(idx, rec);
+    eeprom_write_block(src, ofs, _size);
+    eeprom_write_byte(ofs + _size, idx);
+    eeprom_write_word((uint16_t *)(ofs + _size + 1), copyCrc(ofs));
+  }
+  _active |= 1 << rec;
+}
+
+boolean ConfigStore::commit(const void *src, unsigned char rec)
+{
+  unsigned char idx = ((_active >> rec) & 1) ^ 1;
+  unsigned char *ofs = (unsigned char *)copyAddr(idx, rec);
+  for (unsigned char i=0; i<_size; ++i)
+  {
+    unsigned char val = ((const unsigned char *)src)[i];
+    if (eeprom_read_byte(ofs + i) != val)
+    {
+      eeprom_write_byte(ofs + i, val);
+      return true;
+    }
+  }
+
+  // One past the newer copy's, which is never written while it is newer
+  unsigned char gen = eeprom_read_byte(copyAddr(idx ^ 1, rec) + _size) + 1;
+  if (eeprom_read_byte(ofs + _size) != gen)
+  {
+    eeprom_write_byte(ofs + _size, gen);
+    return true;
+  }
+
+  unsigned int crc = copyCrc(ofs);
+  uint16_t *crcOfs = (uint16_t *)(ofs + _size + 1);
+  if (eeprom_read_word(crcOfs) != crc)
+  {
+    eeprom_write_word(crcOfs, crc);
+    return true;
+  }
+
+  _active ^= 1 << rec;
+  return false;
+}
+
+void ConfigStore::stage(const void *src, unsigned char ofs, unsigned char len, unsigned char rec)
+{
+  unsigned char *dst = (unsigned char *)copyAddr(((_active >> rec) & 1) ^ 1, rec) + ofs;
+  for (unsigned char i=0; i<len; ++i, ++dst)
+  {
+    unsigned char val = ((const unsigned char *)src)[i];
+    if (eeprom_read_byte(dst) != val)
+      eeprom_write_byte(dst, val);
+  }
+}
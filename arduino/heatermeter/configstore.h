@@ -0,0 +1,53 @@
+// HeaterMeter Copyright 2013 Bryan Mayland <bmayland@capnbry.net>
+#ifndef __CONFIGSTORE_H__
+#define __CONFIGSTORE_H__
+
+#include <Arduino.h>
+#include <avr/eeprom.h>
+
+// Bytes each copy has after the struct: a generation then a CRC16 of the
+// struct and generation
+#define CONFIGSTORE_TRAILER 3
+
+// An array of up to 8 config structs (records) kept as two copies in the
+// EEPROM. Changes to a record are always written to its older copy, which
+// only becomes the newer once its generation and CRC are written last, so a
+// reset in the middle of a commit leaves the other copy intact.
+class ConfigStore
+{
+public:
+  ConfigStore(const unsigned char *copyA, const unsigned char *copyB,
+    unsigned char size) : _size(size)
+    { _copy[0] = copyA; _copy[1] = copyB; }
+
+  // Reads the newest valid copy of the record into dst, false if neither
+  // is valid
+  boolean load(void *dst, unsigned char rec = 0);
+  // Writes src to both copies of the record now, the second first so
+  // whatever an in-place migration left in the first stays until it is safe
+  void storeAll(const void *src, unsigned char rec = 0);
+  // Writes at most one byte toward making the record's older copy match
+  // src, then makes it the newer. Returns true while there is more to write.
+  boolean commit(const void *src, unsigned char rec = 0);
+  // Reads the record's newer copy, as last loaded or committed, into dst
+  void read(void *dst, unsigned char rec = 0) const
+    { eeprom_read_block(dst, copyAddr((_active >> rec) & 1, rec), _size); }
+  // Writes len bytes of src at ofs in the record's older copy now, without
+  // making it the newer. A commit() keeps them as long as its src has them
+  // too, readStaged() gets them back to build that src.
+  void stage(const void *src, unsigned char ofs, unsigned char len, unsigned char rec = 0);
+  void readStaged(void *dst, unsigned char ofs, unsigned char len, unsigned char rec = 0) const
+    { eeprom_read_block(dst, copyAddr(((_active >> rec) & 1) ^ 1, rec) + ofs, len); }
+
+private:
+  const unsigned char *copyAddr(unsigned char idx, unsigned char rec) const
+    { return _copy[idx] + rec * (_size + CONFIGSTORE_TRAILER); }
+  unsigned int copyCrc(const unsigned char *ofs) const;
+  boolean copyValid(const unsigned char *ofs) const;
+
+  const unsigned char *_copy[2];
+  const unsigned char _size;
+  unsigned char _active;  // bit per record, set if copy B is the newer
+};
+
+#endif /* __CONFIGSTORE_H__ */
@@ -2,14 +2,17 @@
 // GrillPid uses TIMER1 COMPB vector, as well as modifies the waveform
 // generation mode of TIMER1. Blower output pin needs to be a hardware PWM pin.
 // Fan output is 489Hz phase-correct PWM
-// Servo output is 50Hz pulse duration
+// Servo output is 50Hz pulse duration on any pin, set with direct port writes
+// When GRILLPID_CALC_TEMP is defined, the ADC is also taken over and runs
+// continuously from the ADC conversion complete vector
 #include <math.h>
 #include <string.h>
+#include <util/atomic.h>
 
 #include "strings.h"
 #include "grillpid.h"
 
-extern const GrillPid pid;
+extern GrillPid pid;
 
 // For this calculation to work, ccpm()/8 must return a round number
 #define uSecToTicks(x) ((unsigned int)(clockCyclesPerMicrosecond() / 8) * x)
@@ -18,24 +21,100 @@ extern const GrillPid pid;
 #define mappct(o, a, b)  (((b - a) * (unsigned int)o / 100) + a)
 
 #if defined(GRILLPID_SERVO_ENABLED)
+// Move the pulse at most _servoStepMax toward the output each refresh
+inline unsigned int GrillPid::nextServoPulse(void)
+{
+  unsigned int pulse = _servoOutput;
+  if (_servoStepMax != 0 && _servoPulse != 0)
+  {
+    unsigned int step = uSecToTicks(_servoStepMax);
+    if (pulse > _servoPulse + step)
+      pulse = _servoPulse + step;
+    else if (pulse + step < _servoPulse)
+      pulse = _servoPulse - step;
+  }
+  _servoPulse = pulse;
+  return pulse;
+}
+
 ISR(TIMER1_COMPB_vect)
 {
   // < Servo refresh means time to turn off output
   if (TCNT1 < uSecToTicks(SERVO_REFRESH))
   {
-    digitalWrite(pid.getServoPin(), LOW);
+    pid.setServoPin(LOW);
     OCR1B = uSecToTicks(SERVO_REFRESH);
   }
   // Otherwise this is the end of the refresh period, start again
   else
   {
-    digitalWrite(pid.getServoPin(), HIGH);
-    OCR1B = pid.getServoOutput();
+    pid.setServoPin(HIGH);
     TCNT1 = 0;
+    OCR1B = pid.nextServoPulse();
   }
 }
 #endif
 
+#if defined(GRILLPID_CALC_TEMP)
+// The ADC free runs, cycling through every analog pin and oversampling each
+// one. Finished oversamples go into a small ring per pin that readTemp()
+// drains, so loop() never has to wait on a conversion.
+static struct tagAdcState
+{
+  unsigned char pin;         // Pin currently being sampled
+  unsigned char discard;     // Conversions to throw away after a pin change
+  unsigned char cnt;         // Conversions left in this oversample
+  boolean invalid;           // A conversion in this oversample was 0 or 1023
+  unsigned int accumulator;  // Sum of this oversample
+  unsigned int ring[NUM_ANALOG_INPUTS][TEMP_ADC_RING_SIZE];
+  volatile unsigned char head[NUM_ANALOG_INPUTS];  // Count of oversamples completed
+} adcState;
+
+ISR(ADC_vect)
+{
+  if (adcState.discard != 0)
+  {
+    --adcState.discard;
+    return;
+  }
+
+  unsigned int adc = ADC;
+  // If we get *any* analogReads that are 0 or 1023, the measurement for
+  // the entire oversample is invalidated
+  if (adc == 0 || adc >= 1023)
+    adcState.invalid = true;
+  adcState.accumulator += adc;
+  if (--adcState.cnt != 0)
+    return;
+
+  unsigned char pin = adcState.pin;
+  adcState.ring[pin][adcState.head[pin] % TEMP_ADC_RING_SIZE] =
+    adcState.invalid ? 0 : adcState.accumulator >> TEMP_OVERSAMPLE_BITS;
+  ++adcState.head[pin];
+
+  if (++pin >= NUM_ANALOG_INPUTS)
+    pin = 0;
+  adcState.pin = pin;
+  ADMUX = (ADMUX & 0xf0) | pin;
+  // The conversion already in progress is still on the old pin
+  adcState.discard = 1;
+  adcState.cnt = 1 << (2 * TEMP_OVERSAMPLE_BITS);  // 4^n
+  adcState.accumulator = 0;
+  adcState.invalid = false;
+}
+
+unsigned int analogReadOver(unsigned char pin, unsigned char bits)
+{
+  unsigned int retVal;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    unsigned char last = adcState.head[pin] - 1;
+    retVal = adcState.ring[pin][last % TEMP_ADC_RING_SIZE];
+  }
+  return retVal >> (10 + TEMP_OVERSAMPLE_BITS - bits);
+}
+#endif /* GRILLPID_CALC_TEMP */
+
 static void calcExpMovingAverage(const float smooth, float *currAverage, float newValue)
 {
   if (isnan(*currAverage))
@@ -96,76 +175,276 @@ void ProbeAlarm::setThreshold(unsigned char idx, int value)
 TempProbe::TempProbe(const unsigned char pin) :
   _pin(pin), Temperature(NAN), TemperatureAvg(NAN)
 {
+#if defined(TEMP_LUT_COUNT)
+  _lutIdx = TEMP_LUT_NONE;
+#endif
 }
 
 void TempProbe::loadConfig(struct __eeprom_probe *config)
 {
   _probeType = config->probeType;
+  _filterMode = config->filterMode;
   Offset = config->tempOffset;
   memcpy(Steinhart, config->steinhart, sizeof(Steinhart));
+  calcLut();
   Alarms.setLow(config->alarmLow);
   Alarms.setHigh(config->alarmHigh);
 }
 
+void TempProbe::saveConfig(struct __eeprom_probe *config) const
+{
+  config->probeType = _probeType;
+  config->filterMode = _filterMode;
+  config->tempOffset = Offset;
+  memcpy(config->steinhart, Steinhart, sizeof(Steinhart));
+  config->alarmLow = Alarms.getLow();
+  config->alarmHigh = Alarms.getHigh();
+}
+
+#if defined(TEMP_LUT_COUNT)
+static struct tagTempLut
+{
+  // Coefficients the table was built from, compared to share it
+  float steinhart[STEINHART_COUNT];
+  // Probes using this table, 0 if free
+  unsigned char users;
+  // ADC value (<< TEMP_LUT_FRAC_BITS) at each step of the temperature table
+  unsigned int adc[TEMP_LUT_COUNT];
+} tempLuts[TEMP_LUT_SLOTS];
+
+// Oversampled ADC value for the given Celsius temperature
+static float steinhartToAdc(const float *stein, float tempC)
+{
+  const float ADCmax = (1 << (10+TEMP_OVERSAMPLE_BITS)) - 1;
+  // Solve 1/T = A + B ln(R) + C ln(R)^3 for ln(R)
+  float invT = 1.0f / (tempC + 273.15f);
+  float R;
+  if (stein[2] == 0.0f)
+    R = (invT - stein[0]) / stein[1];
+  else
+  {
+    float x = (stein[0] - invT) / stein[2];
+    float b3c = stein[1] / (3.0f * stein[2]);
+    float y = sqrt(b3c * b3c * b3c + x * x / 4.0f);
+    R = cbrt(y - x / 2.0f) - cbrt(y + x / 2.0f);
+  }
+  R = exp(R);
+  // Fixed resistor on the Vcc side, same as thermistorToC10()
+  return ADCmax * R / (R + stein[3]);
+}
+#endif /* TEMP_LUT_COUNT */
+
+void TempProbe::calcLut(void)
+{
+#if defined(TEMP_LUT_COUNT)
+  // Give up the old table, then share one built from the same coefficients
+  // or build one in a free slot
+  if (_lutIdx != TEMP_LUT_NONE)
+    --tempLuts[_lutIdx].users;
+  _lutIdx = TEMP_LUT_NONE;
+  // Only thermistors read by the ADC use one, the other types' coefficients
+  // aren't Steinhart-Hart
+  if (_probeType != PROBETYPE_INTERNAL)
+    return;
+  unsigned char freeIdx = TEMP_LUT_NONE;
+  for (unsigned char i=0; i<TEMP_LUT_SLOTS; ++i)
+  {
+    if (tempLuts[i].users == 0)
+    {
+      if (freeIdx == TEMP_LUT_NONE)
+        freeIdx = i;
+    }
+    else if (memcmp(tempLuts[i].steinhart, Steinhart, sizeof(Steinhart)) == 0)
+    {
+      ++tempLuts[i].users;
+      _lutIdx = i;
+      return;
+    }
+  }
+  if (freeIdx == TEMP_LUT_NONE)
+    return;
+
+  struct tagTempLut *lut = &tempLuts[freeIdx];
+  lut->users = 1;
+  memcpy(lut->steinhart, Steinhart, sizeof(Steinhart));
+  _lutIdx = freeIdx;
+
+  // The curve sags away from a straight line between every pair of points,
+  // split the difference by moving each point half the sag of its neighbors
+  float adc = steinhartToAdc(Steinhart, TEMP_LUT_MIN);
+  float sagPrev = 0.0f;
+  for (unsigned char i=0; i<TEMP_LUT_COUNT; ++i)
+  {
+    float temp = TEMP_LUT_MIN + i * TEMP_LUT_STEP;
+    float adcNext = 0.0f;
+    float sag = 0.0f;
+    if (i < TEMP_LUT_COUNT - 1)
+    {
+      adcNext = steinhartToAdc(Steinhart, temp + TEMP_LUT_STEP);
+      sag = steinhartToAdc(Steinhart, temp + TEMP_LUT_STEP / 2.0f) - (adc + adcNext) / 2.0f;
+    }
+    if (i == 0)
+      adc += sag / 2.0f;
+    else if (i == TEMP_LUT_COUNT - 1)
+      adc += sagPrev / 2.0f;
+    else
+      adc += (sagPrev + sag) / 4.0f;
+    // Coefficients that don't make a curve in range (NaN fails too) are
+    // left to the float math
+    float val = adc * (1 << TEMP_LUT_FRAC_BITS) + 0.5f;
+    if (!(val >= 0.0f && val < 65536.0f))
+    {
+      lut->users = 0;
+      _lutIdx = TEMP_LUT_NONE;
+      return;
+    }
+    lut->adc[i] = val;
+
+    adc = adcNext;
+    sagPrev = sag;
+  }
+#endif /* TEMP_LUT_COUNT */
+}
+
 void TempProbe::setProbeType(unsigned char probeType)
 {
   _probeType = probeType;
-  _accumulator = 0;
-  _accumulatedCount = 0;
+  _sampleCount = 0;
+  _invalidCount = 0;
   Temperature = NAN;
   TemperatureAvg = NAN;
+  calcLut();
 }
 
-#define DIFFMAX(x,y,d) ((x - y + d) <= (d*2U))
 void TempProbe::addAdcValue(unsigned int analog_temp)
 {
   // any read is 0, data invalid (>= MAX is reduced in readTemp())
   if (analog_temp == 0)
-    _accumulator = 0;
+    ++_invalidCount;
 
-  // this is the first add, store the value directly
-  else if (_accumulatedCount == 0)
-    _accumulator = analog_temp;
+  // insertion sort into the window, anything past a full period is dropped
+  else if (_sampleCount < TEMP_AVG_COUNT)
+  {
+    unsigned char i = _sampleCount++;
+    while (i > 0 && _samples[i-1] > analog_temp)
+    {
+      _samples[i] = _samples[i-1];
+      --i;
+    }
+    _samples[i] = analog_temp;
+  }
+}
 
-  // one of the reads is more than 6.25% off the average, data invalid
-  else if (!DIFFMAX(analog_temp, _accumulator / _accumulatedCount,
-    (1 << (6 + TEMP_OVERSAMPLE_BITS))))
-    _accumulator = 0;
+#define DIFFMAX(x,y,d) ((x - y + d) <= (d*2U))
+unsigned int TempProbe::filterSamples(void)
+{
+  unsigned char cnt = _sampleCount;
+  _rejected += _invalidCount;
+  _sampleCount = 0;
+  _invalidCount = 0;
+  if (cnt == 0)
+    return 0;
 
-  // else normal add
-  else if (_accumulator != 0)
-    _accumulator += analog_temp;
+  unsigned int median = (_samples[(cnt-1) / 2] + _samples[cnt / 2]) / 2;
+  // Average only the samples within 6.25% of the median, impulse noise is
+  // counted but doesn't throw away the rest of the period
+  unsigned int sum = 0;
+  unsigned char used = 0;
+  for (unsigned char i=0; i<cnt; ++i)
+  {
+    if (DIFFMAX(_samples[i], median, (1 << (6 + TEMP_OVERSAMPLE_BITS))))
+    {
+      sum += _samples[i];
+      ++used;
+    }
+    else
+      ++_rejected;
+  }
 
-  ++_accumulatedCount;
+  if (_filterMode == PROBEFILTER_MEDIAN || used == 0)
+    return median;
+  return sum / used;
 }
 
+#if defined(GRILLPID_CALC_TEMP)
 void TempProbe::readTemp(void)
 {
-  const unsigned char OVERSAMPLE_COUNT[] = {1, 4, 16, 64};  // 4^n
+  // Average all the oversamples the ADC finished since the last call. If the
+  // ring was overrun the oldest are lost, which is fine
+  unsigned char head = adcState.head[_pin];
+  unsigned char avail = head - _adcConsumed;
+  if (avail == 0)
+    return;
+  if (avail > TEMP_ADC_RING_SIZE)
+    avail = TEMP_ADC_RING_SIZE;
+  _adcConsumed = head;
+
   unsigned int oversampled_adc = 0;
-  for (unsigned char i=OVERSAMPLE_COUNT[TEMP_OVERSAMPLE_BITS]; i; --i)
+  for (unsigned char i=head-avail; i!=head; ++i)
   {
-    unsigned int adc = analogRead(_pin);
-    // If we get *any* analogReads that are 0 or 1023, the measurement for 
-    // the entire period is invalidated, so set the _accumulator to 0
-    if (adc == 0 || adc >= 1023)
+    unsigned int adc;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+      adc = adcState.ring[_pin][i % TEMP_ADC_RING_SIZE];
+    // Any invalid oversample invalidates the whole read
+    if (adc == 0)
     {
       addAdcValue(0);
       return;
     }
     oversampled_adc += adc;
   }
-  oversampled_adc = oversampled_adc >> TEMP_OVERSAMPLE_BITS;
-  addAdcValue(oversampled_adc);
+  addAdcValue(oversampled_adc / avail);
+}
+#endif /* GRILLPID_CALC_TEMP */
+
+int TempProbe::thermistorToC10(unsigned int adc) const
+{
+#if defined(TEMP_LUT_COUNT)
+  // The table descends as temperature rises, find the step it falls in
+  // and interpolate between it and the next
+  if (_lutIdx != TEMP_LUT_NONE)
+  {
+    const unsigned int *lut = tempLuts[_lutIdx].adc;
+    unsigned int adcFrac = adc << TEMP_LUT_FRAC_BITS;
+    if (adcFrac <= lut[0] && adcFrac > lut[TEMP_LUT_COUNT-1])
+    {
+      unsigned char lo = 0;
+      unsigned char hi = TEMP_LUT_COUNT - 1;
+      while (hi - lo > 1)
+      {
+        unsigned char mid = (lo + hi) / 2;
+        if (lut[mid] >= adcFrac)
+          lo = mid;
+        else
+          hi = mid;
+      }
+      unsigned int span = lut[lo] - lut[hi];
+      return (TEMP_LUT_MIN + lo * TEMP_LUT_STEP) * 10 +
+        ((unsigned long)(lut[lo] - adcFrac) * (TEMP_LUT_STEP * 10) + span / 2) / span;
+    }
+  }
+#endif /* TEMP_LUT_COUNT */
+
+  const float ADCmax = (1 << (10+TEMP_OVERSAMPLE_BITS)) - 1;
+  float R, T;
+  // If you put the fixed resistor on the Vcc side of the thermistor, use the following
+  R = Steinhart[3] / ((ADCmax / (float)adc) - 1.0f);
+  // If you put the thermistor on the Vcc side of the fixed resistor use the following
+  //R = Steinhart[3] * ADCmax / (float)Vout - Steinhart[3];
+
+  // Compute degrees K
+  R = log(R);
+  T = 1.0f / ((Steinhart[2] * R * R + Steinhart[1]) * R + Steinhart[0]);
+  // Way out of range either way, just don't overflow
+  return min(T - 273.15f, 3000.0f) * 10.0f;
 }
 
 void TempProbe::calcTemp(void)
 {
   const float ADCmax = (1 << (10+TEMP_OVERSAMPLE_BITS)) - 1;
-  if (_accumulatedCount != 0)
+  if (_sampleCount != 0 || _invalidCount != 0)
   {
-    unsigned int ADCval = _accumulator / _accumulatedCount;
-    _accumulatedCount = 0;
+    unsigned int ADCval = filterSamples();
 
     // Units 'A' = ADC value
     if (pid.getUnits() == 'A')
@@ -186,28 +465,16 @@ void TempProbe::calcTemp(void)
         // If scale is <100 it is assumed to be mV/C with a 3.3V reference
         if (mvScale < 100.0f)
           mvScale = 3300.0f / mvScale;
-        setTemperatureC(ADCval / ADCmax * mvScale);
+        setTemperatureC10(min(ADCval / ADCmax * mvScale, 3000.0f) * 10.0f);
       }
-      else {
-        float R, T;
-        // If you put the fixed resistor on the Vcc side of the thermistor, use the following
-        R = Steinhart[3] / ((ADCmax / (float)ADCval) - 1.0f);
-        // If you put the thermistor on the Vcc side of the fixed resistor use the following
-        //R = Steinhart[3] * ADCmax / (float)Vout - Steinhart[3];
-
-        // Units 'R' = resistance, unless this is the pit probe (which should spit out Celsius)
-        if (pid.getUnits() == 'R' && this != pid.Probes[TEMP_PIT])
-        {
-          Temperature = R;
-          return;
-        };
-
-        // Compute degrees K
-        R = log(R);
-        T = 1.0f / ((Steinhart[2] * R * R + Steinhart[1]) * R + Steinhart[0]);
-
-        setTemperatureC(T - 273.15f);
-      } /* if PROBETYPE_INTERNAL */
+      // Units 'R' = resistance, unless this is the pit probe (which should spit out Celsius)
+      else if (pid.getUnits() == 'R' && this != pid.Probes[TEMP_PIT])
+      {
+        Temperature = Steinhart[3] / ((ADCmax / (float)ADCval) - 1.0f);
+        return;
+      }
+      else
+        setTemperatureC10(thermistorToC10(ADCval));
     } /* if ADCval */
     else
       Temperature = NAN;
@@ -222,23 +489,24 @@ void TempProbe::calcTemp(void)
     Alarms.silenceAll();
 }
 
-void TempProbe::setTemperatureC(float T)
+void TempProbe::setTemperatureC10(int T)
 {
   // Sanity - anything less than -20C (-4F) or greater than 500C (932F) is rejected
-  if (T <= -20.0f || T > 500.0f)
+  if (T <= -200 || T > 5000)
     Temperature = NAN;
   else
   {
     if (pid.getUnits() == 'F')
-      Temperature = (T * (9.0f / 5.0f)) + 32.0f;
-    else
-      Temperature = T;
-    Temperature += Offset;
+      T += (T * 4 + 2) / 5 + 320;  // T * 9 overflows an int
+    Temperature = T / 10.0f + Offset;
   }
 }
 
 GrillPid::GrillPid(const unsigned char fanPin, const unsigned char servoPin) :
-    _fanPin(fanPin), _servoPin(servoPin), _periodCounter(0x80), _units('F'), PidOutputAvg(NAN)
+    _fanPin(fanPin), _servoPin(servoPin),
+    _servoPort(portOutputRegister(digitalPinToPort(servoPin))),
+    _servoMask(digitalPinToBitMask(servoPin)),
+    _periodCounter(0x80), _sampleId(0), _units('F'), PidOutputAvg(NAN)
 {
   //pinMode(_fanPin, OUTPUT); // handled by analogWrite
 #if defined(GRILLPID_SERVO_ENABLED)
@@ -257,6 +525,15 @@ void GrillPid::init(void) const
   TCCR1B = bit(CS11);
   TIMSK1 = bit(OCIE1B);
 #endif
+#if defined(GRILLPID_CALC_TEMP)
+  // One regular read lets the core set the reference bits in ADMUX, then
+  // switch to free running and let the ISR take it from pin 0
+  analogRead(0);
+  adcState.cnt = 1 << (2 * TEMP_OVERSAMPLE_BITS);
+  adcState.discard = 1;
+  ADCSRB = 0;
+  ADCSRA |= bit(ADATE) | bit(ADIE) | bit(ADSC);
+#endif
 }
 
 unsigned int GrillPid::countOfType(unsigned char probeType) const
@@ -271,6 +548,14 @@ unsigned int GrillPid::countOfType(unsigned char probeType) const
 /* Calucluate the desired output percentage using the proportional–integral-derivative (PID) controller algorithm */
 inline void GrillPid::calcPidOutput(void)
 {
+#if defined(GRILLPID_AUTOTUNE_ENABLED)
+  if (isAutotuneActive())
+  {
+    calcAutotuneOutput();
+    return;
+  }
+#endif
+
   unsigned char lastOutput = _pidOutput;
   _pidOutput = 0;
 
@@ -303,6 +588,119 @@ inline void GrillPid::calcPidOutput(void)
   _pidOutput = constrain(control, 0, 100);
 }
 
+#if defined(GRILLPID_AUTOTUNE_ENABLED)
+void GrillPid::startAutotune(void)
+{
+  memset(&_autotune, 0, sizeof(_autotune));
+  _autotune.state = AUTOTUNE_STARTING;
+  _manualOutputMode = false;
+  LidOpenResumeCountdown = 0;
+}
+
+/* Astrom-Hagglund relay feedback: the output is switched fully on below the
+   setpoint and fully off above it, so the pit oscillates at its ultimate
+   period Pu. The ultimate gain is Ku = 4d/(pi*a) for relay amplitude d and
+   pit amplitude a */
+inline void GrillPid::calcAutotuneOutput(void)
+{
+  const float d = 50.0f;
+  unsigned char lastOutput = _pidOutput;
+  _pidOutput = 0;
+
+  // Lost the pit probe, or ~18 hours without enough oscillations
+  if (!Probes[TEMP_PIT]->hasTemperature() || ++_autotune.seconds == 0)
+  {
+    _autotune.state = AUTOTUNE_FAILED;
+    return;
+  }
+
+  float currentTemp = Probes[TEMP_PIT]->Temperature;
+  if (currentTemp < _autotune.peakMin)
+    _autotune.peakMin = currentTemp;
+  if (currentTemp > _autotune.peakMax)
+    _autotune.peakMax = currentTemp;
+
+  if (_autotune.state == AUTOTUNE_STARTING)
+    lastOutput = 100;
+
+  if (lastOutput != 0 && currentTemp > _setPoint + AUTOTUNE_HYSTERESIS)
+  {
+    // Switching off completes an oscillation. The first one is skipped
+    // while the pit settles into it
+    if (_autotune.state == AUTOTUNE_RUNNING && ++_autotune.cycle > 1)
+    {
+      _autotune.amplitude += _autotune.peakMax - _autotune.peakMin;
+      _autotune.period += _autotune.seconds - _autotune.lastSwitch;
+    }
+    _autotune.state = AUTOTUNE_RUNNING;
+    _autotune.lastSwitch = _autotune.seconds;
+    _autotune.peakMax = currentTemp;
+
+    if (_autotune.cycle > AUTOTUNE_CYCLES)
+    {
+      // Half the peak to peak, less the part from the hysteresis
+      float a = _autotune.amplitude / (2 * AUTOTUNE_CYCLES);
+      a = a * a - (AUTOTUNE_HYSTERESIS * AUTOTUNE_HYSTERESIS);
+      if (a <= 0.0f)
+      {
+        _autotune.state = AUTOTUNE_FAILED;
+        return;
+      }
+      _autotune.amplitude = 4.0f * d / (M_PI * sqrt(a));
+      _autotune.period /= AUTOTUNE_CYCLES;
+      _autotune.state = AUTOTUNE_DONE;
+    }
+  }
+  else if (lastOutput == 0 && currentTemp < _setPoint - AUTOTUNE_HYSTERESIS)
+  {
+    _autotune.peakMin = currentTemp;
+    _pidOutput = 100;
+  }
+  else
+    _pidOutput = lastOutput;
+}
+
+float GrillPid::getAutotunePid(unsigned char idx) const
+{
+  // Ziegler-Nichols "some overshoot" Kp = Ku/3, Ti = Pu/2, Td = Pu/3
+  float ku = _autotune.amplitude;
+  float pu = _autotune.period;
+  float kp = ku / 3.0f;
+  switch (idx)
+  {
+    case PIDP:
+      return kp;
+    case PIDI:
+      // The error is summed once per measure period
+      return kp / (pu / 2.0f) * (TEMP_MEASURE_PERIOD / 1000.0f);
+    case PIDD:
+      // The D term is the difference from the moving average, which lags
+      // a ramp by (1-s)/s periods
+      return kp * (pu / 3.0f) / (TEMP_MEASURE_PERIOD / 1000.0f) *
+        TEMPPROBE_AVG_SMOOTH / (1.0f - TEMPPROBE_AVG_SMOOTH);
+  }
+  return Pid[idx];
+}
+
+void GrillPid::autotuneStatus(void) const
+{
+#if defined(GRILLPID_SERIAL_ENABLED)
+  SerialX.print(_autotune.state, DEC);
+  Serial_csv();
+  SerialX.print(_autotune.cycle, DEC);
+  Serial_csv();
+  SerialX.print(_autotune.seconds, DEC);
+  if (_autotune.state == AUTOTUNE_DONE)
+  {
+    Serial_csv();
+    SerialX.printDec(_autotune.amplitude, 2);
+    Serial_csv();
+    SerialX.printDec(_autotune.period, 0);
+  }
+#endif
+}
+#endif /* GRILLPID_AUTOTUNE_ENABLED */
+
 unsigned char GrillPid::getFanSpeed(void) const
 {
   if (bit_is_set(_outputFlags, PIDFLAG_FAN_ONLY_MAX) && _pidOutput < 100)
@@ -370,7 +768,8 @@ inline void GrillPid::commitServoOutput(void)
   // Get the output speed in 10x usec by LERPing between min and max
   output = mappct(output, _minServoPos, _maxServoPos);
   // Servo output is actually set on the next interrupt cycle
-  _servoOutput = uSecToTicks(10U * output);
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    _servoOutput = uSecToTicks(10U * output);
 #endif
 }
 
@@ -404,6 +803,9 @@ void GrillPid::setSetPoint(int value)
   _manualOutputMode = false;
   _pidCurrent[PIDI] = 0.0f;
   LidOpenResumeCountdown = 0;
+#if defined(GRILLPID_AUTOTUNE_ENABLED)
+  stopAutotune();
+#endif
 }
 
 void GrillPid::setPidOutput(int value)
@@ -411,6 +813,9 @@ void GrillPid::setPidOutput(int value)
   _manualOutputMode = true;
   _pidOutput = constrain(value, 0, 100);
   LidOpenResumeCountdown = 0;
+#if defined(GRILLPID_AUTOTUNE_ENABLED)
+  stopAutotune();
+#endif
 }
 
 void GrillPid::setLidOpenDuration(unsigned int value)
@@ -426,26 +831,67 @@ void GrillPid::setPidConstant(unsigned char idx, float value)
     _pidCurrent[PIDI] = 0.0f;
 }
 
-void GrillPid::status(void) const
+void GrillPid::status(unsigned char fields) const
 {
 #if defined(GRILLPID_SERIAL_ENABLED)
-  SerialX.print(getSetPoint(), DEC);
+  struct serialx_rec_status rec;
+  statusRec(rec);
+
+  if (fields & STATUS_SETPOINT)
+    SerialX.print(rec.setPoint, DEC);
   Serial_csv();
 
   for (unsigned char i=0; i<TEMP_COUNT; ++i)
   {
-    if (Probes[i]->hasTemperature())
-      SerialX.print(Probes[i]->Temperature, 1);
-    else
-      Serial_char('U');
+    if (fields & (STATUS_TEMP0 << i))
+    {
+      if (Probes[i]->hasTemperature())
+        SerialX.printFixed(lround(Probes[i]->Temperature * 10.0f), 1);
+      else
+        Serial_char('U');
+    }
     Serial_csv();
   }
 
-  SerialX.print(getPidOutput(), DEC);
+  if (fields & STATUS_OUTPUT)
+    SerialX.print(rec.output, DEC);
   Serial_csv();
-  SerialX.print((int)PidOutputAvg, DEC);
+  if (fields & STATUS_OUTPUTAVG)
+    SerialX.print(rec.outputAvg, DEC);
   Serial_csv();
-  SerialX.print(LidOpenResumeCountdown, DEC);
+  if (fields & STATUS_LID)
+    SerialX.print(rec.lidCountdown, DEC);
+  Serial_csv();
+  SerialX.print(rec.sampleId, DEC);
+#endif
+}
+
+void GrillPid::statusRec(struct serialx_rec_status &rec) const
+{
+#if defined(GRILLPID_SERIAL_ENABLED)
+  rec.setPoint = getSetPoint();
+  for (unsigned char i=0; i<TEMP_COUNT; ++i)
+  {
+    if (Probes[i]->hasTemperature())
+      rec.temps[i] = lround(Probes[i]->Temperature * 10.0f);
+    else
+      rec.temps[i] = SERIALX_TEMP_NONE;
+  }
+  rec.output = getPidOutput();
+  rec.outputAvg = (int)PidOutputAvg;
+  rec.lidCountdown = LidOpenResumeCountdown;
+  rec.sampleId = _sampleId;
+#endif
+}
+
+void GrillPid::statusFrame(void) const
+{
+#if defined(GRILLPID_SERIAL_ENABLED)
+  struct serialx_rec_status rec;
+  statusRec(rec);
+  SerialX.beginFrame(SERIALX_REC_STATUS);
+  SerialX.frameWrite(&rec, sizeof(rec));
+  SerialX.endFrame();
 #endif
 }
 
@@ -512,7 +958,12 @@ boolean GrillPid::doWork(void)
     // Note that the code assumes we're not currently counting down
     else if (_pitTemperatureReached && 
       (((_setPoint-pitTemp)*100/_setPoint) >= (int)LidOpenOffset) &&
-      ((int)PidOutputAvg < 90))
+      ((int)PidOutputAvg < 90)
+#if defined(GRILLPID_AUTOTUNE_ENABLED)
+      // the relay's swings aren't the lid
+      && !isAutotuneActive()
+#endif
+      )
     {
       resetLidOpenResumeCountdown();
     }
@@ -520,6 +971,7 @@ boolean GrillPid::doWork(void)
 #endif
 
   commitPidOutput();
+  ++_sampleId;
   return true;
 }
 
@@ -527,18 +979,29 @@ void GrillPid::pidStatus(void) const
 {
 #if defined(GRILLPID_SERIAL_ENABLED)
   TempProbe const* const pit = Probes[TEMP_PIT];
-  if (pit->hasTemperature())
+  if (!pit->hasTemperature())
+    return;
+
+  if (SerialX.isBinary())
   {
-    print_P(PSTR("HMPS"CSV_DELIMITER));
-    for (unsigned char i=PIDB; i<=PIDD; ++i)
-    {
-      SerialX.print(_pidCurrent[i], 2);
-      Serial_csv();
-    }
+    struct serialx_rec_pidint rec;
+    memcpy(rec.pid, _pidCurrent, sizeof(rec.pid));
+    rec.pitDelta = pit->Temperature - pit->TemperatureAvg;
+    SerialX.beginFrame(SERIALX_REC_PIDINT);
+    SerialX.frameWrite(&rec, sizeof(rec));
+    SerialX.endFrame();
+    return;
+  }
 
-    SerialX.print(pit->Temperature - pit->TemperatureAvg, 2);
-    Serial_nl();
+  print_P(PSTR("HMPS" CSV_DELIMITER));
+  for (unsigned char i=PIDB; i<=PIDD; ++i)
+  {
+    SerialX.printDec(_pidCurrent[i], 2);
+    Serial_csv();
   }
+
+  SerialX.printDec(pit->Temperature - pit->TemperatureAvg, 2);
+  Serial_nl();
 #endif
 }
 
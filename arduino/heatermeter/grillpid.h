@@ -7,22 +7,42 @@
 
 #define PROBE_NAME_SIZE 13
 
+// Fields of the status(), a set bit means the field is printed
+#define STATUS_SETPOINT  0x01
+#define STATUS_TEMP0     0x02  // one bit per probe from here
+#define STATUS_OUTPUT    0x20
+#define STATUS_OUTPUTAVG 0x40
+#define STATUS_LID       0x80
+#define STATUS_ALL       0xff
+
+struct serialx_rec_status;
+
 // Probe types used in probeType config
 #define PROBETYPE_DISABLED 0  // do not read
 #define PROBETYPE_INTERNAL 1  // read via analogRead()
 #define PROBETYPE_RF12     2  // RFM12B wireless
 #define PROBETYPE_TC_ANALOG  3  // Analog thermocouple, Stein[3] is mV/C
 
+// Probe filters used in filterMode config, how the samples in a period are combined
+#define PROBEFILTER_TRIMMED 0  // mean of the samples near the median
+#define PROBEFILTER_MEDIAN  1  // median
+
 #define STEINHART_COUNT 4
 
-struct __eeprom_probe
+// Fractional bits kept in the TEMP_LUT ADC values, as many as fit in 16 bits
+#define TEMP_LUT_FRAC_BITS (16 - 10 - TEMP_OVERSAMPLE_BITS)
+// TempProbe is not using any of the shared tables
+#define TEMP_LUT_NONE 0xff
+
+// Fixed width and packed like __eeprom_data, for the host build in hmsim
+struct __attribute__((packed)) __eeprom_probe
 {
   char name[PROBE_NAME_SIZE];
   unsigned char probeType;
   char tempOffset;
-  int alarmLow;
-  int alarmHigh;
-  char unused1;
+  int16_t alarmLow;
+  int16_t alarmHigh;
+  unsigned char filterMode;
   char unused2;
   float steinhart[STEINHART_COUNT];  // The last one is actually Rknown
 };
@@ -60,9 +80,25 @@ class TempProbe
 {
 private:
   const unsigned char _pin; 
-  unsigned char _accumulatedCount;
-  unsigned int _accumulator;
+  // Valid samples this period, kept sorted
+  unsigned int _samples[TEMP_AVG_COUNT];
+  unsigned char _sampleCount;
+  unsigned char _invalidCount;
   unsigned char _probeType;  
+  unsigned char _filterMode;
+  unsigned int _rejected;
+#if defined(GRILLPID_CALC_TEMP)
+  // Count of oversamples taken out of the ADC ring
+  unsigned char _adcConsumed;
+#endif
+#if defined(TEMP_LUT_COUNT)
+  // Shared temperature table in use, TEMP_LUT_NONE for the float math
+  unsigned char _lutIdx;
+#endif
+  // Temperature in tenths of a degree C for a thermistor ADC reading
+  int thermistorToC10(unsigned int adc) const;
+  // Combine the period's samples into one ADC value, 0 if none are valid
+  unsigned int filterSamples(void);
   
 public:
   TempProbe(const unsigned char pin);
@@ -73,29 +109,49 @@ public:
   void setProbeType(unsigned char probeType);
   // Offset (in degrees) applied when calculating temperature
   char Offset;
-  // Steinhart coefficients
+  // Steinhart coefficients, call calcLut() after changing
   float Steinhart[STEINHART_COUNT];
+  void calcLut(void);
+#if defined(TEMP_LUT_COUNT)
+  // True if a shared temperature table is in use instead of the float math
+  boolean hasLut(void) const { return _lutIdx != TEMP_LUT_NONE; }
+#endif
+  // PROBEFILTER_*
+  unsigned char getFilterMode(void) const { return _filterMode; }
+  void setFilterMode(unsigned char filterMode) { _filterMode = filterMode; }
   // Copy struct to members
   void loadConfig(struct __eeprom_probe *config);
-  // Takes a Temperarure ADC value and adds it to the accumulator
+  // Copy members back to struct, the name is left alone
+  void saveConfig(struct __eeprom_probe *config) const;
+  // Takes a Temperarure ADC value and adds it to the period's samples
   void addAdcValue(unsigned int analog_temp);
+  // Samples that were invalid or too far from the median, since boot
+  unsigned int getRejected(void) const { return _rejected; }
 
   /* Runtime Data/Methods */
   // Last averaged temperature reading
   float Temperature;
   boolean hasTemperature(void) const { return !isnan(Temperature); }
-  void setTemperatureC(float T);
+  // Set the Temperature from tenths of a degree C
+  void setTemperatureC10(int T);
   // Temperature moving average 
   float TemperatureAvg;
   boolean hasTemperatureAvg(void) const { return !isnan(TemperatureAvg); }
-  // Do the duty of reading ADC
+#if defined(GRILLPID_CALC_TEMP)
+  // Collect the readings the ADC interrupt has finished
   void readTemp(void);
+#endif
   // Convert ADC to Temperature
   void calcTemp(void);
   
   ProbeAlarm Alarms;
 };
 
+#if defined(GRILLPID_CALC_TEMP)
+// Most recent oversampled reading of an analog pin, scaled to [bits] bits
+unsigned int analogReadOver(unsigned char pin, unsigned char bits);
+#endif
+
 // Indexes into the pid array
 #define PIDB 0
 #define PIDP 1
@@ -112,11 +168,21 @@ public:
 // Servo opens (to max) when pidOutput>0 (any output)
 #define PIDFLAG_SERVO_ANY_MAX 3
 
+// Autotune states
+#define AUTOTUNE_OFF      0
+#define AUTOTUNE_STARTING 1  // output on until the pit first passes the setpoint
+#define AUTOTUNE_RUNNING  2  // relay oscillating around the setpoint
+#define AUTOTUNE_DONE     3  // getAutotunePid() has the new constants
+#define AUTOTUNE_FAILED   4  // pit probe lost or never oscillated
+
 class GrillPid
 {
 private:
   unsigned char const _fanPin;
   unsigned char const _servoPin;
+  // Servo pin's output register and bit, so the ISR can skip digitalWrite()
+  volatile unsigned char * const _servoPort;
+  unsigned char const _servoMask;
 
   unsigned char _pidOutput;
   unsigned long _lastWorkMillis;
@@ -124,12 +190,15 @@ private:
   int _setPoint;
   boolean _manualOutputMode;
   unsigned char _periodCounter;
+  unsigned int _sampleId;
   // Counter used for "long PWM" mode
   unsigned char _longPwmTmr;
   unsigned int _lidOpenDuration;
   // Last values used in PID calculation = B + P + I + D;
   float _pidCurrent[4];
   unsigned int _servoOutput;
+  unsigned int _servoPulse;
+  unsigned char _servoStepMax;
   char _units;
   unsigned char _maxFanSpeed;
   unsigned char _minFanSpeed;
@@ -141,6 +210,20 @@ private:
 #endif
 
   unsigned char _outputFlags;
+#if defined(GRILLPID_AUTOTUNE_ENABLED)
+  struct tagAutotune
+  {
+    unsigned char state;
+    unsigned char cycle;       // completed oscillations
+    unsigned int seconds;      // since start
+    unsigned int lastSwitch;   // seconds at the last on to off switch
+    float peakMin;             // lowest pit temperature since turning on
+    float peakMax;             // highest pit temperature since turning off
+    float amplitude;           // sum of peak to peak, then ultimate gain Ku
+    float period;              // sum of periods, then ultimate period Pu
+  } _autotune;
+  void calcAutotuneOutput(void);
+#endif
   
   void calcPidOutput(void);
   void commitFanOutput(void);
@@ -185,6 +268,9 @@ public:
   // The duration (in 10x usec) for the minimum servo position
   unsigned char getMinServoPos(void) const { return _minServoPos; }
   void setMinServoPos(unsigned char value) { _minServoPos = value; }
+  // The most the servo pulse may change per refresh (in usec), 0 = no limit
+  unsigned char getServoStepMax(void) const { return _servoStepMax; }
+  void setServoStepMax(unsigned char value) { _servoStepMax = value; }
 
   // Collection of PIDFLAG_*
   void setOutputFlags(unsigned char value) { _outputFlags = value; }
@@ -196,9 +282,18 @@ public:
   void setPidOutput(int value);
   // Current fan speed output in percent
   unsigned char getFanSpeed(void) const;
-  // Current servo output in TIMER1 ticks
+  // Servo output the pulse is moving toward in TIMER1 ticks
   unsigned int getServoOutput(void) const { return _servoOutput; }
+  // Servo pulse currently being output in TIMER1 ticks
+  unsigned int getServoPulse(void) const { return _servoPulse; }
+  // Called from the TIMER1 ISR to start a pulse, returns its length
+  unsigned int nextServoPulse(void);
+  void setServoPin(unsigned char level)
+    { if (level) *_servoPort |= _servoMask; else *_servoPort &= ~_servoMask; }
   unsigned long getLastWorkMillis(void) const { return _lastWorkMillis; }
+  // Counts every period doWork() completes, 16-bit wrapping. Sent with the
+  // status so receivers can tell a dropped status from a skipped one.
+  unsigned int getSampleId(void) const { return _sampleId; }
 
   boolean getManualOutputMode(void) const { return _manualOutputMode; }
   // PID output moving average
@@ -216,10 +311,28 @@ public:
   // true if temperature was >= setpoint since last set / lid event
   boolean isPitTempReached(void) const { return _pitTemperatureReached; }
   
+#if defined(GRILLPID_AUTOTUNE_ENABLED)
+  // Relay feedback autotune around the current setpoint, changing
+  // the setpoint or output stops it
+  void startAutotune(void);
+  void stopAutotune(void) { _autotune.state = AUTOTUNE_OFF; }
+  unsigned char getAutotuneState(void) const { return _autotune.state; }
+  boolean isAutotuneActive(void) const
+    { return _autotune.state == AUTOTUNE_STARTING || _autotune.state == AUTOTUNE_RUNNING; }
+  // Tuned PIDP, PIDI or PIDD constant once AUTOTUNE_DONE
+  float getAutotunePid(unsigned char idx) const;
+  void autotuneStatus(void) const;
+#endif
+
   // Call this in loop()
   boolean doWork(void);
   void resetLidOpenResumeCountdown(void);
-  void status(void) const;
+  // Fields not in fields are left blank, the sample id is always sent
+  void status(unsigned char fields = STATUS_ALL) const;
+  // The status() values as a SERIALX_REC_STATUS record
+  void statusRec(struct serialx_rec_status &rec) const;
+  // Binary SERIALX_REC_STATUS frame of the status()
+  void statusFrame(void) const;
   void pidStatus(void) const;
 };
 
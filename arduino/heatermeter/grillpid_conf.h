@@ -4,6 +4,7 @@
 #define GRILLPID_SERIAL_ENABLED
 #define GRILLPID_SERVO_ENABLED
 #define GRILLPID_FAN_BOOST_ENABLED
+#define GRILLPID_AUTOTUNE_ENABLED
 
 #define TEMP_PIT    0
 #define TEMP_FOOD1  1
@@ -13,6 +14,18 @@
 
 // Use oversample/decimation to increase ADC resolution to 2^(10+n) bits n=[0..3]
 #define TEMP_OVERSAMPLE_BITS 3
+// Number of finished oversamples the ADC interrupt buffers per pin (2^n)
+#define TEMP_ADC_RING_SIZE 4
+
+// Thermistor temperatures are interpolated from a table of the ADC value at
+// every TEMP_LUT_STEP C starting from TEMP_LUT_MIN C. Readings outside the
+// table fall back to the Steinhart-Hart float math. Probes with the same
+// coefficients share a table, a probe that finds none of the TEMP_LUT_SLOTS
+// free uses the float math for every reading
+#define TEMP_LUT_COUNT 33
+#define TEMP_LUT_MIN   -20
+#define TEMP_LUT_STEP  10
+#define TEMP_LUT_SLOTS 2
 
 // The time (ms) of the measurement period
 #define TEMP_MEASURE_PERIOD 1000
@@ -25,6 +38,12 @@
 // LID OPEN mode before autoresuming due to temperature returning to setpoint
 #define LIDOPEN_MIN_AUTORESUME 30
 
+// Relay autotune switches the output fully on and off this many degrees
+// either side of the setpoint, and averages this many oscillations after
+// the first
+#define AUTOTUNE_HYSTERESIS 2
+#define AUTOTUNE_CYCLES     4
+
 // Servo refresh period in usec, 20000 usec = 20ms = 50Hz
 #define SERVO_REFRESH          20000
 
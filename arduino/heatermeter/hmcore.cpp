@@ -3,6 +3,7 @@
 #include <avr/eeprom.h>
 #include <avr/wdt.h>
 #include <avr/power.h>
+#include <util/crc16.h>
 
 #include "hmcore.h"
 
@@ -12,6 +13,10 @@
 
 #include "bigchars.h"
 #include "ledmanager.h"
+#include "tasksched.h"
+#include "samplehist.h"
+#include "configstore.h"
+#include "hmeeprom.h"
 
 static TempProbe probe0(PIN_PIT);
 static TempProbe probe1(PIN_FOOD1);
@@ -41,34 +46,53 @@ static LedManager ledmanager(&ledExecutor);
 static unsigned char g_AlarmId; // ID of alarm going off
 static unsigned char g_HomeDisplayMode;
 static unsigned char g_LogPidInternals; // If non-zero then log PID interals
-unsigned char g_LcdBacklight; // 0-100
-
-#define config_store_byte(eeprom_field, src) { eeprom_write_byte((uint8_t *)offsetof(__eeprom_data, eeprom_field), src); }
-#define config_store_word(eeprom_field, src) { eeprom_write_word((uint16_t *)offsetof(__eeprom_data, eeprom_field), src); }
 
-#define EEPROM_MAGIC 0xf00e
+// Periodic segments the host subscribes to with /set?sb. Until it does,
+// they go out as they always have. Intervals are in periods, 0 is off.
+#define SUB_STATUS   0  // $HMSU, or $HMSD with only what changed
+#define SUB_PIDINT   1  // $HMPS, still only if enabled by /set?tp
+#define SUB_RF       2  // $HMRF
+#define SUB_KEYFRAME 3  // a full $HMSU at least this often
+#define SUB_COUNT    4
+static boolean g_Subscribed;
+static unsigned char g_SubInterval[SUB_COUNT] = { 1, 1, 32, 10 };
+static unsigned char g_SubElapsed[SUB_COUNT];  // periods since last sent
+static struct serialx_rec_status g_StatusSent; // the last status the host got
+#define CONFIG_REPORT_DONE 0xff
+static unsigned char g_ConfigReportStep = CONFIG_REPORT_DONE; // next reportConfig() segment
+static void reportTaskStats(void); // prototype
+static void eepromLoadBaseConfig(unsigned char forceDefault); // prototype
+static void eepromLoadProbeConfig(unsigned char forceDefault); // prototype
+
+// One history sample every this many temperature periods (seconds)
+#define HISTORY_PERIOD 20
+static SampleHistory history;
+static history_cursor_t g_HistoryDump;
+static boolean g_HistoryDumping;
+static unsigned int g_HistoryDumpEnd; // newest seq when /history was sent
+unsigned char g_LcdBacklight; // 0-100
 
-static const struct __eeprom_data {
-  unsigned int magic;
-  int setPoint;
-  unsigned char lidOpenOffset;
-  unsigned int lidOpenDuration;
-  float pidConstants[4]; // constants are stored Kb, Kp, Ki, Kd
-  boolean manualMode;
-  unsigned char lcdBacklight; // in PWM (max 100)
-#ifdef HEATERMETER_RFM12
-  unsigned char rfMap[TEMP_COUNT];
-#endif
-  char pidUnits;
-  unsigned char minFanSpeed;  // in percent
-  unsigned char maxFanSpeed;  // in percent
-  unsigned char pidOutputFlags;
-  unsigned char homeDisplayMode;
-  unsigned char unused;
-  unsigned char ledConf[LED_COUNT];
-  unsigned char minServoPos;  // in percent
-  unsigned char maxServoPos;  // in percent
-} DEFAULT_CONFIG[] PROGMEM = {
+// Stores go to the RAM copy of the config, eepromCommit() writes them later.
+// In a transaction they are staged instead, and the caller leaves the
+// setting itself alone until the commit applies it
+#define config_store_byte(eeprom_field, src) { __typeof__(g_Config.eeprom_field) val_ = (src); \
+  configStore(offsetof(__eeprom_data, eeprom_field), &val_, sizeof(val_)); }
+#define config_store_word config_store_byte
+// Hot fields are written to the next hot slot instead of their base location
+#define config_store_hot(eeprom_field, src) { g_Config.eeprom_field = src; \
+  g_HotSlotDirty = true; g_ConfigDirtyMillis = millis(); }
+// Probe fields only need staging in a transaction, otherwise the TempProbe
+// is changed and eepromCommit() saves it
+#define probe_stage(probeIndex, eeprom_field, src) { __typeof__(((__eeprom_probe *)0)->eeprom_field) val_ = (src); \
+  txnStageProbe(probeIndex, offsetof(__eeprom_probe, eeprom_field), &val_, sizeof(val_)); }
+
+// The layout is versioned by EEPROM_SCHEMA_VERSION in the header. 0xf00e was
+// the last layout without a header and is migrated from as version 0
+#define EEPROM_MAGIC    0xf00f
+#define EEPROM_MAGIC_V0 0xf00e
+#define EEPROM_SCHEMA_VERSION 1
+
+static const struct __eeprom_data DEFAULT_CONFIG[] PROGMEM = {
  {
   EEPROM_MAGIC,  // magic
   225,  // setpoint
@@ -85,15 +109,58 @@ static const struct __eeprom_data {
   100,  // max fan speed
   0x00, // PID output flags bitmask
   0xff, // 2-line home
-  0xff, // unused
+  0,    // servo step max (no limit)
   { LEDSTIMULUS_RfReceive, LEDSTIMULUS_LidOpen, LEDSTIMULUS_FanOn, LEDSTIMULUS_Off },
   60, // min servo pos = 600us
   250  // max servo pos = 2500us
 }
 };
 
-// EEPROM address of the start of the probe structs, the 2 bytes before are magic
-#define EEPROM_PROBE_START  64
+// Schema version, only read once the base config has EEPROM_MAGIC
+#define EEPROM_HEADER_START 0x2f0
+
+struct __eeprom_header
+{
+  unsigned char version;
+};
+#define header_addr(field) ((unsigned char *)EEPROM_HEADER_START + offsetof(__eeprom_header, field))
+
+static ConfigStore baseStore((const unsigned char *)EEPROM_BASE_A_START,
+  (const unsigned char *)EEPROM_BASE_B_START, sizeof(__eeprom_data));
+
+// RAM copy of the base config and the range of it [Lo, Hi) that differs
+// from the EEPROM, written back once left alone for CONFIG_COMMIT_DELAY
+static struct __eeprom_data g_Config;
+static unsigned char g_ConfigDirtyLo = 0xff;
+static unsigned char g_ConfigDirtyHi;
+static unsigned long g_ConfigDirtyMillis;
+#define CONFIG_COMMIT_DELAY 2000
+// Probes whose EEPROM struct is behind the TempProbe, bit per probe
+static unsigned char g_ProbeDirty;
+// The probe structs, a record each with two copies like the base config
+static ConfigStore probeStore((const unsigned char *)EEPROM_PROBE_A_START,
+  (const unsigned char *)EEPROM_PROBE_B_START, sizeof(__eeprom_probe));
+// Names have no RAM copy, a new one is staged in the probe's older copy
+// and these probes' commits take it from there, bit per probe
+static unsigned char g_ProbeNamePending;
+
+// Config transaction, opened by /set?cfg=1. Setters stage their values in
+// the older EEPROM copy of each record they change and hold their reports,
+// nothing takes effect until /set?cfg=0 checks the staged records and
+// applies them at once. A discard only has to rewrite those copies.
+static boolean g_ConfigTxnOpen;
+static unsigned long g_ConfigTxnMillis; // last command in the transaction
+static unsigned char g_ConfigTxnTouched; // TXN_* records staged so far
+#define TXN_PROBES   0x0f  // bit per probe, same as g_ProbeDirty
+#define TXN_BASE     0x10
+#define TXN_SETPOINT 0x20  // the base's setpoint, applied by storeSetPoint()
+#define CONFIG_TXN_TIMEOUT 10000
+
+// Each region has to end before the next one starts. The first base config
+// copy also has to leave version 0's probe structs and their magic alone.
+#define eeprom_fits(start, size, next) typedef char start##_fits[((start) + (size) <= (next)) ? 1 : -1]
+#define EEPROM_BASE_COPY_SIZE  (sizeof(__eeprom_data) + CONFIGSTORE_TRAILER)
+#define EEPROM_PROBE_COPY_SIZE (TEMP_COUNT * (sizeof(__eeprom_probe) + CONFIGSTORE_TRAILER))
 
 static const struct  __eeprom_probe DEFAULT_PROBE_CONFIG PROGMEM = {
   "Probe  ", // Name if you change this change the hardcoded number-appender in eepromLoadProbeConfig()
@@ -101,7 +168,7 @@ static const struct  __eeprom_probe DEFAULT_PROBE_CONFIG PROGMEM = {
   0,  // offset
   -40,  // alarm low
   -200, // alarm high
-  0,  // unused1
+  PROBEFILTER_TRIMMED,  // filterMode
   0,  // unused2
   {
     2.4723753e-4,2.3402251e-4,1.3879768e-7  // Maverick ET-72/73
@@ -112,6 +179,71 @@ static const struct  __eeprom_probe DEFAULT_PROBE_CONFIG PROGMEM = {
   }
 };
 
+// Cook program, a list of setpoints each held until its trigger is reached
+// Stored in EEPROM right after version 0's probe structs
+#define EEPROM_COOKPROG_START (EEPROM_PROBE_V0_START + TEMP_COUNT * sizeof(__eeprom_probe))
+#define COOKPROG_STEP_COUNT 8
+#define COOKPROG_STOPPED    0xff
+
+// Step triggers, stored in the top bits of the step's trigger word
+#define COOKTRIG_HOLD   0  // never leave this step
+#define COOKTRIG_TIME   1  // after value minutes
+#define COOKTRIG_PROBE  2  // 2+N: probe N reaches value degrees
+#define COOKTRIG_SHIFT  13
+#define COOKTRIG_VALUE_MASK ((1 << COOKTRIG_SHIFT) - 1)
+
+struct __cookprog_step
+{
+  int setPoint;  // same as storeSetPoint(), <= 0 is a manual output
+  unsigned int trigger;  // COOKTRIG_* << COOKTRIG_SHIFT | value
+};
+
+struct __eeprom_cookprog
+{
+  unsigned char activeStep;  // COOKPROG_STOPPED if not running
+  unsigned char stepCount;
+  struct __cookprog_step steps[COOKPROG_STEP_COUNT];
+};
+#define cookprog_addr(field) ((unsigned char *)EEPROM_COOKPROG_START + offsetof(__eeprom_cookprog, field))
+
+// Letters used for the trigger in the /set?cp and $HMCP step strings
+static const char COOKTRIG_CHARS[] PROGMEM = "tpfga";
+
+// RAM copy of the cook program, eepromCommit() writes it back like the
+// base config. stepCount is never over COOKPROG_STEP_COUNT here.
+static struct __eeprom_cookprog g_CookProg = { COOKPROG_STOPPED };
+static boolean g_CookProgDirty;
+static unsigned long g_CookStepStart;
+
+// The setpoint and manual mode change too often to keep rewriting the same
+// cells, each change goes in the next of a ring of slots instead. The newest
+// slot with a good CRC wins, so one torn by a power loss is skipped.
+#define EEPROM_HOTSLOT_START 0x300
+#define HOTSLOT_COUNT        32
+#define HOTSLOT_CRC_SEED     0x5a
+
+struct __eeprom_hotslot
+{
+  unsigned char seq;  // one more than the previous slot written
+  int setPoint;
+  boolean manualMode;
+  unsigned char crc;  // _crc_ibutton_update of the above
+};
+#define hotslot_addr(slot) ((unsigned char *)EEPROM_HOTSLOT_START + (slot) * sizeof(__eeprom_hotslot))
+
+eeprom_fits(EEPROM_BASE_A_START, EEPROM_BASE_COPY_SIZE, EEPROM_PROBE_V0_START - 2);
+eeprom_fits(EEPROM_COOKPROG_START, sizeof(__eeprom_cookprog), EEPROM_PROBE_A_START);
+eeprom_fits(EEPROM_PROBE_A_START, EEPROM_PROBE_COPY_SIZE, EEPROM_PROBE_B_START);
+eeprom_fits(EEPROM_PROBE_B_START, EEPROM_PROBE_COPY_SIZE, EEPROM_BASE_B_START);
+eeprom_fits(EEPROM_BASE_B_START, EEPROM_BASE_COPY_SIZE, EEPROM_HEADER_START);
+eeprom_fits(EEPROM_HEADER_START, sizeof(__eeprom_header), EEPROM_HOTSLOT_START);
+eeprom_fits(EEPROM_HOTSLOT_START, HOTSLOT_COUNT * sizeof(__eeprom_hotslot), E2END + 1);
+
+static struct __eeprom_hotslot g_HotSlot; // newest slot, or the one being written
+static unsigned char g_HotSlotIdx = HOTSLOT_COUNT - 1;
+static unsigned char g_HotSlotWritePos = sizeof(__eeprom_hotslot); // next byte of g_HotSlot to write
+static boolean g_HotSlotDirty;
+
 #ifdef PIEZO_HZ
 // A simple beep-beep-beep-(pause) alarm
 static unsigned char tone_durs[] PROGMEM = { 10, 5, 10, 5, 10, 50 };  // in 10ms units
@@ -120,6 +252,228 @@ static unsigned char tone_idx;
 static unsigned long tone_last;
 #endif /* PIZEO_HZ */
 
+static void configDirty(unsigned char ofs, unsigned char len)
+{
+  if (ofs < g_ConfigDirtyLo)
+    g_ConfigDirtyLo = ofs;
+  if (ofs + len > g_ConfigDirtyHi)
+    g_ConfigDirtyHi = ofs + len;
+  g_ConfigDirtyMillis = millis();
+}
+
+// The first change staged to the base config brings its older copy up to
+// g_Config, which it can lag by whatever the last commit wrote
+static void txnStageBase(unsigned char ofs, const void *src, unsigned char len)
+{
+  if ((g_ConfigTxnTouched & TXN_BASE) == 0)
+  {
+    baseStore.stage(&g_Config, 0, sizeof(g_Config));
+    g_ConfigTxnTouched |= TXN_BASE;
+  }
+  baseStore.stage(src, ofs, len);
+}
+
+static void configStore(unsigned char ofs, const void *src, unsigned char len)
+{
+  if (g_ConfigTxnOpen)
+    txnStageBase(ofs, src, len);
+  else
+  {
+    memcpy((unsigned char *)&g_Config + ofs, src, len);
+    configDirty(ofs, len);
+  }
+}
+
+static unsigned char hotSlotCrc(const struct __eeprom_hotslot *slot)
+{
+  unsigned char crc = HOTSLOT_CRC_SEED;
+  for (unsigned char i=0; i<offsetof(__eeprom_hotslot, crc); ++i)
+    crc = _crc_ibutton_update(crc, ((const unsigned char *)slot)[i]);
+  return crc;
+}
+
+static void probeConfigDirty(unsigned char probeIndex)
+{
+  g_ProbeDirty |= 1 << probeIndex;
+  g_ConfigDirtyMillis = millis();
+}
+
+// Brings the probe's older EEPROM copy one byte closer to the TempProbe,
+// false once it is written and has become the newer
+static boolean eepromCommitProbe(unsigned char probeIndex)
+{
+  struct __eeprom_probe probe;
+  probeStore.read(&probe, probeIndex);
+  if (g_ProbeNamePending & (1 << probeIndex))
+    probeStore.readStaged(probe.name, offsetof(__eeprom_probe, name), PROBE_NAME_SIZE, probeIndex);
+  pid.Probes[probeIndex]->saveConfig(&probe);
+  return probeStore.commit(&probe, probeIndex);
+}
+
+// Same for a probe, its older copy is brought up to the TempProbe. A name
+// still pending there is committed first or a discard would lose it.
+static void txnStageProbe(unsigned char probeIndex, unsigned char ofs,
+  const void *src, unsigned char len)
+{
+  unsigned char bit = 1 << probeIndex;
+  if ((g_ConfigTxnTouched & bit) == 0)
+  {
+    if (g_ProbeNamePending & bit)
+    {
+      while (eepromCommitProbe(probeIndex))
+        ;
+      g_ProbeDirty &= ~bit;
+      g_ProbeNamePending &= ~bit;
+    }
+    struct __eeprom_probe probe;
+    probeStore.read(&probe, probeIndex);
+    pid.Probes[probeIndex]->saveConfig(&probe);
+    probeStore.stage(&probe, 0, sizeof(probe), probeIndex);
+    g_ConfigTxnTouched |= bit;
+  }
+  probeStore.stage(src, ofs, len, probeIndex);
+}
+
+// The probe's type, as staged if a transaction has changed the probe
+static unsigned char txnProbeType(unsigned char probeIndex)
+{
+  if ((g_ConfigTxnTouched & (1 << probeIndex)) == 0)
+    return pid.Probes[probeIndex]->getProbeType();
+  unsigned char probeType;
+  probeStore.readStaged(&probeType, offsetof(__eeprom_probe, probeType),
+    sizeof(probeType), probeIndex);
+  return probeType;
+}
+
+static void cookProgDirty(void)
+{
+  g_CookProgDirty = true;
+  g_ConfigDirtyMillis = millis();
+}
+
+// Writes the last byte of the cook program's EEPROM struct that differs from
+// g_CookProg, false once they match. Back to front so the step count and
+// active step only change once the steps they cover are written.
+static boolean eepromCommitCookProg(void)
+{
+  unsigned char i = sizeof(g_CookProg);
+  while (i-- > 0)
+  {
+    unsigned char *ofs = (unsigned char *)EEPROM_COOKPROG_START + i;
+    unsigned char val = ((unsigned char *)&g_CookProg)[i];
+    if (eeprom_read_byte(ofs) != val)
+    {
+      eeprom_write_byte(ofs, val);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Writes at most one byte of the changed config, once nothing has changed
+// for CONFIG_COMMIT_DELAY so bursts of edits are written once. Each byte
+// takes 3.4ms to program, so doing one per call keeps the loop moving.
+// Returns true while there is more to write.
+static boolean eepromCommit(void)
+{
+  if (!eeprom_is_ready())
+    return true;
+
+  // A slot that has been started is always finished first
+  if (g_HotSlotWritePos < sizeof(g_HotSlot))
+  {
+    eeprom_write_byte(hotslot_addr(g_HotSlotIdx) + g_HotSlotWritePos,
+      ((unsigned char *)&g_HotSlot)[g_HotSlotWritePos]);
+    ++g_HotSlotWritePos;
+    return true;
+  }
+
+  // An open transaction is only written once committed
+  if (g_ConfigTxnOpen)
+    return false;
+  if (!g_HotSlotDirty && g_ConfigDirtyLo >= g_ConfigDirtyHi && g_ProbeDirty == 0 &&
+    !g_CookProgDirty)
+    return false;
+  if (millis() - g_ConfigDirtyMillis < CONFIG_COMMIT_DELAY)
+    return true;
+
+  if (g_HotSlotDirty)
+  {
+    ++g_HotSlot.seq;
+    g_HotSlot.setPoint = g_Config.setPoint;
+    g_HotSlot.manualMode = g_Config.manualMode;
+    g_HotSlot.crc = hotSlotCrc(&g_HotSlot);
+    g_HotSlotIdx = (g_HotSlotIdx + 1) % HOTSLOT_COUNT;
+    g_HotSlotWritePos = 0;
+    g_HotSlotDirty = false;
+    return true;
+  }
+
+  // The older copy is brought up to date as a whole, it also missed
+  // whatever the last commit wrote to the newer one
+  if (g_ConfigDirtyLo < g_ConfigDirtyHi)
+  {
+    if (!baseStore.commit(&g_Config))
+    {
+      g_ConfigDirtyLo = 0xff;
+      g_ConfigDirtyHi = 0;
+    }
+    return true;
+  }
+
+  if (g_ProbeDirty != 0)
+  {
+    unsigned char probeIndex = 0;
+    while ((g_ProbeDirty & (1 << probeIndex)) == 0)
+      ++probeIndex;
+    if (!eepromCommitProbe(probeIndex))
+    {
+      g_ProbeDirty &= ~(1 << probeIndex);
+      g_ProbeNamePending &= ~(1 << probeIndex);
+    }
+    return true;
+  }
+
+  if (g_CookProgDirty)
+  {
+    if (!eepromCommitCookProg())
+      g_CookProgDirty = false;
+    return true;
+  }
+  return false;
+}
+
+// Write everything now, before a reboot
+static void eepromFlush(void)
+{
+  g_ConfigDirtyMillis = millis() - CONFIG_COMMIT_DELAY;
+  while (eepromCommit())
+    ;
+  eeprom_busy_wait();
+}
+
+// Finds the newest valid hot slot, false if there are none
+static boolean eepromLoadHotSlot(void)
+{
+  boolean found = false;
+  struct __eeprom_hotslot slot;
+  for (unsigned char i=0; i<HOTSLOT_COUNT; ++i)
+  {
+    eeprom_read_block(&slot, hotslot_addr(i), sizeof(slot));
+    if (slot.crc != hotSlotCrc(&slot))
+      continue;
+    // Valid slots are all within HOTSLOT_COUNT writes of each other so
+    // the wrapping difference says which is newer
+    if (!found || (signed char)(slot.seq - g_HotSlot.seq) > 0)
+    {
+      g_HotSlot = slot;
+      g_HotSlotIdx = i;
+      found = true;
+    }
+  }
+  return found;
+}
+
 void setLcdBacklight(unsigned char lcdBacklight)
 {
   /* If the high bit is set, that means just set the output, do not store */
@@ -129,41 +483,48 @@ void setLcdBacklight(unsigned char lcdBacklight)
   analogWrite(PIN_LCD_BACKLGHT, (unsigned int)(lcdBacklight) * 255 / 100);
 }
 
-// Note the storage loaders and savers expect the entire config storage is less than 256 bytes
-static unsigned char getProbeConfigOffset(unsigned char probeIndex, unsigned char off)
-{
-  if (probeIndex >= TEMP_COUNT)
-    return 0;
-  // Point to the name in the first probe_config structure
-  unsigned char retVal = EEPROM_PROBE_START + off;
-  // Stride to the proper configuration structure
-  retVal += probeIndex * sizeof( __eeprom_probe);
-  
-  return retVal;
-}
-
+// The name's bytes that changed are written to the older copy right away,
+// it only becomes the probe's name once eepromCommit() makes that the newer
 static void storeProbeName(unsigned char probeIndex, const char *name)
 {
-  unsigned char ofs = getProbeConfigOffset(probeIndex, offsetof( __eeprom_probe, name));
-  if (ofs != 0)
-    eeprom_write_block(name, (void *)ofs, PROBE_NAME_SIZE);
+  if (probeIndex >= TEMP_COUNT)
+    return;
+  char staged[PROBE_NAME_SIZE];
+  strncpy(staged, name, sizeof(staged) - 1);
+  staged[sizeof(staged) - 1] = '\0';
+  // A transaction's commit marks it pending along with the rest
+  if (g_ConfigTxnOpen)
+  {
+    txnStageProbe(probeIndex, offsetof(__eeprom_probe, name), staged, sizeof(staged));
+    return;
+  }
+  probeStore.stage(staged, offsetof(__eeprom_probe, name), sizeof(staged), probeIndex);
+  g_ProbeNamePending |= 1 << probeIndex;
+  probeConfigDirty(probeIndex);
 }
 
 void loadProbeName(unsigned char probeIndex)
 {
-  unsigned char ofs = getProbeConfigOffset(probeIndex, offsetof( __eeprom_probe, name));
-  if (ofs != 0)
-    eeprom_read_block(editString, (void *)ofs, PROBE_NAME_SIZE);
+  if (probeIndex >= TEMP_COUNT)
+    return;
+  if (g_ProbeNamePending & (1 << probeIndex))
+    probeStore.readStaged(editString, offsetof(__eeprom_probe, name), PROBE_NAME_SIZE, probeIndex);
+  else
+  {
+    struct __eeprom_probe probe;
+    probeStore.read(&probe, probeIndex);
+    memcpy(editString, probe.name, PROBE_NAME_SIZE);
+  }
 }
 
-void storeSetPoint(int sp)
+static void storeCookSetPoint(int sp)
 {
   // If the setpoint is >0 that's an actual setpoint.  
   // 0 or less is a manual fan speed
   boolean isManualMode;
   if (sp > 0)
   {
-    config_store_word(setPoint, sp);
+    config_store_hot(setPoint, sp);
     pid.setSetPoint(sp);
     
     isManualMode = false;
@@ -174,33 +535,139 @@ void storeSetPoint(int sp)
     isManualMode = true;
   }
 
-  config_store_byte(manualMode, isManualMode);
+  config_store_hot(manualMode, isManualMode);
+}
+
+static void outputCookStatus(void)
+{
+#ifdef HEATERMETER_SERIAL
+  print_P(PSTR("HMCS" CSV_DELIMITER));
+  SerialX.print(g_CookProg.activeStep, DEC);
+  Serial_csv();
+  SerialX.print(g_CookProg.stepCount, DEC);
+  Serial_csv();
+  if (g_CookProg.activeStep != COOKPROG_STOPPED)
+    SerialX.print((millis() - g_CookStepStart) / 60000UL, DEC);
+  Serial_nl();
+#endif /* HEATERMETER_SERIAL */
+}
+
+// Only while a program is running, stopping is reported once by setCookStep()
+static void reportCookStatus(void)
+{
+  if (g_CookProg.activeStep != COOKPROG_STOPPED)
+    outputCookStatus();
+}
+
+static void setCookStep(unsigned char step)
+{
+  if (step >= g_CookProg.stepCount)
+    step = COOKPROG_STOPPED;
+  if (step == g_CookProg.activeStep && step == COOKPROG_STOPPED)
+    return;
+
+  g_CookProg.activeStep = step;
+  g_CookStepStart = millis();
+  cookProgDirty();
+  if (step != COOKPROG_STOPPED)
+    storeCookSetPoint(g_CookProg.steps[step].setPoint);
+  outputCookStatus();
+}
+
+// Called every period, moves to the next step once the trigger is reached
+static void checkCookProgram(void)
+{
+  if (g_CookProg.activeStep == COOKPROG_STOPPED)
+    return;
+
+  unsigned int trigger = g_CookProg.steps[g_CookProg.activeStep].trigger;
+  unsigned char type = trigger >> COOKTRIG_SHIFT;
+  int value = trigger & COOKTRIG_VALUE_MASK;
+  boolean advance;
+  if (type == COOKTRIG_HOLD)
+    advance = false;
+  else if (type == COOKTRIG_TIME)
+    advance = (millis() - g_CookStepStart) / 60000UL >= (unsigned int)value;
+  else
+  {
+    TempProbe *probe = pid.Probes[(type - COOKTRIG_PROBE) % TEMP_COUNT];
+    advance = probe->hasTemperature() && probe->Temperature >= value;
+  }
+
+  // Completing the last step stops the program and leaves its setpoint
+  if (advance)
+    setCookStep(g_CookProg.activeStep + 1);
+  else
+    reportCookStatus();
+}
+
+void storeSetPoint(int sp)
+{
+  // Staged as is, a manual output too, the commit brings it back here
+  if (g_ConfigTxnOpen)
+  {
+    int16_t staged = sp;
+    txnStageBase(offsetof(__eeprom_data, setPoint), &staged, sizeof(staged));
+    g_ConfigTxnTouched |= TXN_SETPOINT;
+    return;
+  }
+  // Setting the setpoint by hand ends any cook program
+  setCookStep(COOKPROG_STOPPED);
+  storeCookSetPoint(sp);
 }
 
 static void storePidUnits(char units)
 {
-  pid.setUnits(units);
-  if (units == 'C' || units == 'F')
+  boolean stored = (units == 'C' || units == 'F');
+  if (stored)
     config_store_byte(pidUnits, units);
+  // The others are never stored, so they don't wait for a commit
+  if (!stored || !g_ConfigTxnOpen)
+    pid.setUnits(units);
 }
 
 static void storeProbeOffset(unsigned char probeIndex, int offset)
 {
-  unsigned char ofs = getProbeConfigOffset(probeIndex, offsetof( __eeprom_probe, tempOffset));
-  if (ofs != 0)
+  if (probeIndex >= TEMP_COUNT)
+    return;
+  if (g_ConfigTxnOpen)
+  {
+    probe_stage(probeIndex, tempOffset, offset);
+  }
+  else
   {
     pid.Probes[probeIndex]->Offset = offset;
-    eeprom_write_byte((unsigned char *)ofs, offset);
-  }  
+    probeConfigDirty(probeIndex);
+  }
+}
+
+static void storeProbeFilter(unsigned char probeIndex, int filterMode)
+{
+  if (probeIndex >= TEMP_COUNT)
+    return;
+  if (g_ConfigTxnOpen)
+  {
+    probe_stage(probeIndex, filterMode, filterMode);
+  }
+  else
+  {
+    pid.Probes[probeIndex]->setFilterMode(filterMode);
+    probeConfigDirty(probeIndex);
+  }
 }
 
 static void storeProbeType(unsigned char probeIndex, unsigned char probeType)
 {
-  unsigned char ofs = getProbeConfigOffset(probeIndex, offsetof( __eeprom_probe, probeType));
-  if (ofs != 0)
+  if (probeIndex >= TEMP_COUNT)
+    return;
+  if (g_ConfigTxnOpen)
+  {
+    probe_stage(probeIndex, probeType, probeType);
+  }
+  else
   {
     pid.Probes[probeIndex]->setProbeType(probeType);
-    eeprom_write_byte((unsigned char *)ofs, probeType);
+    probeConfigDirty(probeIndex);
   }
 }
 
@@ -219,21 +686,32 @@ static void reportRfMap(void)
 
 static void checkInitRfManager(void)
 {
+  rfmanager.setAllowed(rfMap, TEMP_COUNT);
   if (pid.countOfType(PROBETYPE_RF12) != 0)
     rfmanager.init(HEATERMETER_RFM12);
 }
 
 static void storeRfMap(unsigned char probeIndex, unsigned char source)
 {
-  rfMap[probeIndex] = source;
-
-  unsigned char *ofs = (unsigned char *)offsetof(__eeprom_data, rfMap);
-  ofs += probeIndex;
-  eeprom_write_byte(ofs, source);
+  configStore(offsetof(__eeprom_data, rfMap) + probeIndex, &source, sizeof(source));
+  if (g_ConfigTxnOpen)
+    return;
 
+  rfMap[probeIndex] = source;
   reportRfMap();
   checkInitRfManager();
 }
+
+// The probe's source, as staged if a transaction has changed the base config
+static unsigned char txnRfMap(unsigned char probeIndex)
+{
+  if ((g_ConfigTxnTouched & TXN_BASE) == 0)
+    return rfMap[probeIndex];
+  unsigned char source;
+  baseStore.readStaged(&source, offsetof(__eeprom_data, rfMap) + probeIndex,
+    sizeof(source));
+  return source;
+}
 #endif /* HEATERMETER_RFM12 */
 
 static void storeProbeTypeOrMap(unsigned char probeIndex, unsigned char probeType)
@@ -241,7 +719,7 @@ static void storeProbeTypeOrMap(unsigned char probeIndex, unsigned char probeTyp
   /* If probeType is < 128 it is just a probe type */
   if (probeType < 128)
   {
-    unsigned char oldProbeType = pid.Probes[probeIndex]->getProbeType();
+    unsigned char oldProbeType = txnProbeType(probeIndex);
     if (oldProbeType != probeType)
     {
       storeProbeType(probeIndex, probeType);
@@ -259,8 +737,8 @@ static void storeProbeTypeOrMap(unsigned char probeIndex, unsigned char probeTyp
     unsigned char newSrc = probeType - 128;
     /* Force the storage of TempProbe::setProbeType() if the src changes
        because we need to clear Temperature and any accumulated ADC readings */
-    if (pid.Probes[probeIndex]->getProbeType() != PROBETYPE_RF12 ||
-      rfMap[probeIndex] != newSrc)
+    if (txnProbeType(probeIndex) != PROBETYPE_RF12 ||
+      txnRfMap(probeIndex) != newSrc)
       storeProbeType(probeIndex, PROBETYPE_RF12);
     storeRfMap(probeIndex, newSrc);
   }  /* if RF map */
@@ -270,49 +748,62 @@ static void storeProbeTypeOrMap(unsigned char probeIndex, unsigned char probeTyp
 static void storeMinFanSpeed(unsigned char minFanSpeed)
 {
   minFanSpeed = constrain(minFanSpeed, 0, 100);
-  pid.setMinFanSpeed(minFanSpeed);
   config_store_byte(minFanSpeed, minFanSpeed);
+  if (!g_ConfigTxnOpen)
+    pid.setMinFanSpeed(minFanSpeed);
 }
 
 static void storeMaxFanSpeed(unsigned char maxFanSpeed)
 {
   maxFanSpeed = constrain(maxFanSpeed, 0, 100);
-  pid.setMaxFanSpeed(maxFanSpeed);
   config_store_byte(maxFanSpeed, maxFanSpeed);
+  if (!g_ConfigTxnOpen)
+    pid.setMaxFanSpeed(maxFanSpeed);
 }
 
 static void storeMinServoPos(unsigned char minServoPos)
 {
-  pid.setMinServoPos(minServoPos);
   config_store_byte(minServoPos, minServoPos);
+  if (!g_ConfigTxnOpen)
+    pid.setMinServoPos(minServoPos);
 }
 
 static void storeMaxServoPos(unsigned char maxServoPos)
 {
-  pid.setMaxServoPos(maxServoPos);
   config_store_byte(maxServoPos, maxServoPos);
+  if (!g_ConfigTxnOpen)
+    pid.setMaxServoPos(maxServoPos);
+}
+
+static void storeServoStepMax(unsigned char servoStepMax)
+{
+  config_store_byte(servoStepMax, servoStepMax);
+  if (!g_ConfigTxnOpen)
+    pid.setServoStepMax(servoStepMax);
 }
 
 static void storeInvertPidOutput(unsigned char pidOutputFlags)
 {
-  pid.setOutputFlags(pidOutputFlags);
   config_store_byte(pidOutputFlags, pidOutputFlags);
+  if (!g_ConfigTxnOpen)
+    pid.setOutputFlags(pidOutputFlags);
 }
 
 void storeLcdBacklight(unsigned char lcdBacklight)
 {
   lcdBacklight = constrain(lcdBacklight, 0, 100);
-  setLcdBacklight(lcdBacklight);
   config_store_byte(lcdBacklight, lcdBacklight);
+  if (!g_ConfigTxnOpen)
+    setLcdBacklight(lcdBacklight);
 }
 
 static void storeLedConf(unsigned char led, unsigned char ledConf)
 {
-  ledmanager.setAssignment(led, ledConf);
-
-  unsigned char *ofs = (unsigned char *)offsetof(__eeprom_data, ledConf);
-  ofs += led;
-  eeprom_write_byte(ofs, ledConf);
+  if (led >= LED_COUNT)
+    return;
+  configStore(offsetof(__eeprom_data, ledConf) + led, &ledConf, sizeof(ledConf));
+  if (!g_ConfigTxnOpen)
+    ledmanager.setAssignment(led, ledConf);
 }
 
 static void toneEnable(boolean enable)
@@ -505,47 +996,90 @@ static void storePidParam(char which, float value)
     default:
       return;
   }
-  pid.setPidConstant(k, value);
+  configStore(offsetof(__eeprom_data, pidConstants) + k * sizeof(float), &value, sizeof(value));
+  if (!g_ConfigTxnOpen)
+    pid.setPidConstant(k, value);
+}
 
-  unsigned char ofs = offsetof(__eeprom_data, pidConstants[0]);
-  eeprom_write_block(&pid.Pid[k], (void *)(ofs + k * sizeof(float)), sizeof(value));
+static void subscriptionTick(void)
+{
+  for (unsigned char i=0; i<SUB_COUNT; ++i)
+    if (g_SubElapsed[i] != 0xff)
+      ++g_SubElapsed[i];
 }
 
-static void outputCsv(void)
+static boolean subscriptionDue(unsigned char sub)
 {
-#ifdef HEATERMETER_SERIAL
-  print_P(PSTR("HMSU" CSV_DELIMITER));
-  pid.status();
-  Serial_nl();
-#endif /* HEATERMETER_SERIAL */
+  return g_SubInterval[sub] != 0 && g_SubElapsed[sub] >= g_SubInterval[sub];
 }
 
-#if defined(HEATERMETER_SERIAL)
-static void printSciFloat(float f)
+// true if the segment is due, and starts its next interval
+static boolean subscriptionTake(unsigned char sub)
+{
+  if (!subscriptionDue(sub))
+    return false;
+  g_SubElapsed[sub] = 0;
+  return true;
+}
+
+// Status fields that differ between a and b, STATUS_* bits
+static unsigned char statusChanged(const struct serialx_rec_status &a,
+  const struct serialx_rec_status &b)
+{
+  unsigned char retVal = 0;
+  if (a.setPoint != b.setPoint)
+    retVal |= STATUS_SETPOINT;
+  for (unsigned char i=0; i<TEMP_COUNT; ++i)
+    if (a.temps[i] != b.temps[i])
+      retVal |= STATUS_TEMP0 << i;
+  if (a.output != b.output)
+    retVal |= STATUS_OUTPUT;
+  if (a.outputAvg != b.outputAvg)
+    retVal |= STATUS_OUTPUTAVG;
+  if (a.lidCountdown != b.lidCountdown)
+    retVal |= STATUS_LID;
+  return retVal;
+}
+
+static void outputCsv(void)
 {
-  // This function could use a rework, it is pretty expensive
-  // in terms of space and speed. 
-  char exponent = 0;
-  bool neg = f < 0.0f;
-  if (neg)
-    f *= -1.0f;
-  while (f < 1.0f && f != 0.0f)
+#ifdef HEATERMETER_SERIAL
+  unsigned char fields = STATUS_ALL;
+  if (g_Subscribed)
   {
-    --exponent;
-    f *= 10.0f;
+    // Changes that come faster than the interval are sent together
+    if (!subscriptionDue(SUB_STATUS))
+      return;
+    struct serialx_rec_status rec;
+    pid.statusRec(rec);
+    if (!subscriptionDue(SUB_KEYFRAME))
+    {
+      fields = statusChanged(rec, g_StatusSent);
+      if (fields == 0)
+        return;
+    }
+    if (fields == STATUS_ALL)
+      g_SubElapsed[SUB_KEYFRAME] = 0;
+    g_SubElapsed[SUB_STATUS] = 0;
+    g_StatusSent = rec;
   }
-  while (f >= 10.0f)
+
+  // Binary frames are small enough to always be whole
+  if (SerialX.isBinary())
+    pid.statusFrame();
+  else
   {
-    ++exponent;
-    f /= 10.0f;
+    if (fields == STATUS_ALL)
+      print_P(PSTR("HMSU" CSV_DELIMITER));
+    else
+      print_P(PSTR("HMSD" CSV_DELIMITER));
+    pid.status(fields);
+    Serial_nl();
   }
-  if (neg)
-    f *= -1.0f;
-  SerialX.print(f, 7);
-  Serial_char('e');
-  SerialX.print(exponent, DEC);
+#endif /* HEATERMETER_SERIAL */
 }
 
+#if defined(HEATERMETER_SERIAL)
 static void reportProbeCoeff(unsigned char probeIdx)
 {
   print_P(PSTR("HMPC" CSV_DELIMITER));
@@ -555,7 +1089,7 @@ static void reportProbeCoeff(unsigned char probeIdx)
   TempProbe *p = pid.Probes[probeIdx];
   for (unsigned char i=0; i<STEINHART_COUNT; ++i)
   {
-    printSciFloat(p->Steinhart[i]);
+    SerialX.printSci(p->Steinhart[i], 7);
     Serial_csv();
   }
   SerialX.print(p->getProbeType(), DEC);
@@ -566,8 +1100,7 @@ static void storeProbeCoeff(unsigned char probeIndex, char *vals)
 {
   // vals is SteinA(float),SteinB(float),SteinC(float),RKnown(float),probeType+1(int)|probeMap(char+int)
   // If any value is blank, it won't be modified
-  unsigned char ofs = getProbeConfigOffset(probeIndex, offsetof( __eeprom_probe, steinhart));
-  if (ofs == 0)
+  if (probeIndex >= TEMP_COUNT)
     return;
     
   unsigned char idx = 0;
@@ -579,25 +1112,39 @@ static void storeProbeCoeff(unsigned char probeIndex, char *vals)
     {
       ++idx;
       ++vals;
-      ofs += sizeof(float);
     }
     else
     {
-      float *fDest = &pid.Probes[probeIndex]->Steinhart[idx];
-      *fDest = atof(vals);
-      eeprom_write_block(fDest, (void *)ofs, sizeof(float));
+      float val = atof(vals);
+      if (g_ConfigTxnOpen)
+        txnStageProbe(probeIndex, offsetof(__eeprom_probe, steinhart) + idx * sizeof(float),
+          &val, sizeof(val));
+      else
+        pid.Probes[probeIndex]->Steinhart[idx] = val;
       while (*vals && *vals != ',')
         ++vals;
     }
   }
 
+  TempProbe *p = pid.Probes[probeIndex];
+  unsigned char oldProbeType = p->getProbeType();
   if (*vals)
     storeProbeTypeOrMap(probeIndex, atoi(vals));
+  if (g_ConfigTxnOpen)
+    return;
+
+  probeConfigDirty(probeIndex);
+  // A new type already had its table built by setProbeType()
+  if (p->getProbeType() == oldProbeType)
+    p->calcLut();
   reportProbeCoeff(probeIndex);
 }
 
 static void reboot(void)
 {
+  // An open transaction never took effect, the rest has to be written
+  g_ConfigTxnOpen = false;
+  eepromFlush();
   // Once the pin goes low, the avr should reboot
   digitalWrite(PIN_SOFTRESET, LOW);
   // Use the watchdog in case SOFTRESET isn't hooked up (e.g. HM4.0)
@@ -626,12 +1173,41 @@ static void reportPidParams(void)
   for (unsigned char i=0; i<4; ++i)
   {
     Serial_csv();
-    //printSciFloat(pid.Pid[i]);
-    SerialX.print(pid.Pid[i], 8);
+    SerialX.printDec(pid.Pid[i], 8);
   }
   Serial_nl();
 }
 
+#if defined(GRILLPID_AUTOTUNE_ENABLED)
+static void reportAutotune(void)
+{
+#ifdef HEATERMETER_SERIAL
+  print_P(PSTR("HMAT" CSV_DELIMITER));
+  pid.autotuneStatus();
+  Serial_nl();
+#endif /* HEATERMETER_SERIAL */
+}
+
+static void checkAutotune(void)
+{
+  unsigned char state = pid.getAutotuneState();
+  if (state == AUTOTUNE_OFF)
+    return;
+
+  reportAutotune();
+  if (state == AUTOTUNE_DONE)
+  {
+    storePidParam('p', pid.getAutotunePid(PIDP));
+    storePidParam('i', pid.getAutotunePid(PIDI));
+    storePidParam('d', pid.getAutotunePid(PIDD));
+    reportPidParams();
+  }
+  // Done and failed are only reported once
+  if (!pid.isAutotuneActive())
+    pid.stopAutotune();
+}
+#endif /* GRILLPID_AUTOTUNE_ENABLED */
+
 static void reportProbeOffsets(void)
 {
   print_P(PSTR("HMPO"));
@@ -643,6 +1219,17 @@ static void reportProbeOffsets(void)
   Serial_nl();
 }
 
+static void reportProbeFilters(void)
+{
+  print_P(PSTR("HMPF"));
+  for (unsigned char i=0; i<TEMP_COUNT; ++i)
+  {
+    Serial_csv();
+    SerialX.print(pid.Probes[i]->getFilterMode(), DEC);
+  }
+  Serial_nl();
+}
+
 void storeAndReportProbeOffset(unsigned char probeIndex, int offset)
 {
   storeProbeOffset(probeIndex, offset);
@@ -693,11 +1280,14 @@ void storeLcdParam(unsigned char idx, int val)
       storeLcdBacklight(val);
       break;
     case 1:
+      config_store_byte(homeDisplayMode, val);
+      if (g_ConfigTxnOpen)
+        break;
       g_HomeDisplayMode = val;
-      config_store_byte(homeDisplayMode, g_HomeDisplayMode);
       // If we're in home, clear in case we're switching from 4 to 2
       if (isMenuHomeState())
         lcd.clear();
+      break;
     case 2:
     case 3:
     case 4:
@@ -707,12 +1297,6 @@ void storeLcdParam(unsigned char idx, int val)
   }
 }
 
-static void reportProbeCoeffs(void)
-{
-  for (unsigned char i=0; i<TEMP_COUNT; ++i)
-    reportProbeCoeff(i);
-}
-
 static void reportAlarmLimits(void)
 {
 #ifdef HEATERMETER_SERIAL
@@ -743,6 +1327,8 @@ static void reportFanParams(void)
   SerialX.print(pid.getMaxServoPos(), DEC);
   Serial_csv();
   SerialX.print(pid.getOutputFlags(), DEC);
+  Serial_csv();
+  SerialX.print(pid.getServoStepMax(), DEC);
   Serial_nl();
 }
 
@@ -752,21 +1338,159 @@ void storeAndReportMaxFanSpeed(unsigned char maxFanSpeed)
   reportFanParams();
 }
 
-static void reportConfig(void)
+static void reportCookProgram(void)
 {
-  reportVersion();
-  reportPidParams();
-  reportFanParams();
-  reportProbeNames();
-  reportProbeCoeffs();
-  reportProbeOffsets();
-  reportLidParameters();
-  reportLcdParameters();
-  reportAlarmLimits();
-#ifdef HEATERMETER_RFM12
-  reportRfMap();  
-#endif /* HEATERMETER_RFM12 */
-}
+  print_P(PSTR("HMCP"));
+  for (unsigned char i=0; i<g_CookProg.stepCount; ++i)
+  {
+    Serial_csv();
+    SerialX.print(g_CookProg.steps[i].setPoint, DEC);
+    unsigned int trigger = g_CookProg.steps[i].trigger;
+    unsigned char type = trigger >> COOKTRIG_SHIFT;
+    if (type != COOKTRIG_HOLD)
+    {
+      Serial_char(pgm_read_byte(&COOKTRIG_CHARS[type - COOKTRIG_TIME]));
+      SerialX.print(trigger & COOKTRIG_VALUE_MASK, DEC);
+    }
+  }
+  Serial_nl();
+}
+
+/* storeCookProgram: Steps are SetPoint[TriggerValue],... where the trigger is
+   t=minutes p=pit f=food1 g=food2 a=ambient reaches value, none holds */
+static void storeCookProgram(const char *vals)
+{
+  unsigned char cnt = 0;
+  while (*vals && cnt < COOKPROG_STEP_COUNT)
+  {
+    int sp = atoi(vals);
+    if (*vals == '-')
+      ++vals;
+    while (isdigit(*vals))
+      ++vals;
+
+    unsigned int trigger = COOKTRIG_HOLD;
+    if (*vals && *vals != ',')
+    {
+      const char *t = strchr_P(COOKTRIG_CHARS, *vals++);
+      unsigned int value = atoi(vals);
+      while (isdigit(*vals))
+        ++vals;
+      if (t != NULL)
+        trigger = ((t - COOKTRIG_CHARS + COOKTRIG_TIME) << COOKTRIG_SHIFT) |
+          (value & COOKTRIG_VALUE_MASK);
+    }
+
+    g_CookProg.steps[cnt].setPoint = sp;
+    g_CookProg.steps[cnt].trigger = trigger;
+    ++cnt;
+    if (*vals == ',')
+      ++vals;
+  }
+
+  // A new program doesn't start on its own
+  setCookStep(COOKPROG_STOPPED);
+  g_CookProg.stepCount = cnt;
+  cookProgDirty();
+  reportCookProgram();
+}
+
+static void reportSerialMode(void)
+{
+  print_P(PSTR("HMSM" CSV_DELIMITER));
+  SerialX.print(SerialX.isBinary(), DEC);
+  Serial_csv();
+  SerialX.print(SerialX.getTxOverflows(), DEC);
+  Serial_nl();
+}
+
+// The config is several hundred bytes, more than the TX buffer holds, so
+// it is sent one segment at a time by reportConfigStep()
+static void reportConfig(void)
+{
+  g_ConfigReportStep = 0;
+}
+
+static void reportConfigStep(void)
+{
+  // Only send with the TX buffer empty so status output never waits on it
+  if (g_ConfigReportStep == CONFIG_REPORT_DONE || !SerialX.txRoom(SERIALX_TX_BUFFER))
+    return;
+
+  unsigned char step = g_ConfigReportStep++;
+  switch (step)
+  {
+    case 0: reportVersion(); break;
+    case 1: reportPidParams(); break;
+    case 2: reportFanParams(); break;
+    case 3: reportProbeNames(); break;
+    case 4:
+    case 5:
+    case 6:
+    case 7:
+      reportProbeCoeff(step - 4);
+      break;
+    case 8: reportProbeOffsets(); break;
+    case 9: reportProbeFilters(); break;
+    case 10: reportLidParameters(); break;
+    case 11: reportLcdParameters(); break;
+    case 12: reportAlarmLimits(); break;
+    case 13:
+#ifdef HEATERMETER_RFM12
+      reportRfMap();
+#endif /* HEATERMETER_RFM12 */
+      break;
+    case 14: reportCookProgram(); break;
+    case 15: reportSerialMode(); break;
+    default:
+      g_ConfigReportStep = CONFIG_REPORT_DONE;
+  }
+}
+
+static void reportHistory(void)
+{
+  print_P(PSTR("HMHI" CSV_DELIMITER));
+  SerialX.print(history.getNewestSeq(), DEC);
+  Serial_csv();
+  SerialX.print(history.getCount(), DEC);
+  Serial_csv();
+  SerialX.print(HISTORY_PERIOD, DEC);
+  Serial_nl();
+
+  history.rewind(g_HistoryDump);
+  g_HistoryDumpEnd = history.getNewestSeq();
+  g_HistoryDumping = history.getCount() != 0;
+}
+
+// Like the config, the history goes out one sample at a time
+static void reportHistoryStep(void)
+{
+  if (!g_HistoryDumping || !SerialX.txRoom(SERIALX_TX_BUFFER))
+    return;
+
+  history_sample_t s;
+  unsigned int seq = g_HistoryDump.seq;
+  if ((int)(g_HistoryDumpEnd - seq) < 0 || !history.next(g_HistoryDump, s))
+  {
+    g_HistoryDumping = false;
+    return;
+  }
+  // next() skips samples dropped since the last step
+  seq = g_HistoryDump.seq - 1;
+
+  print_P(PSTR("HMHS" CSV_DELIMITER));
+  SerialX.print(seq, DEC);
+  for (unsigned char i=0; i<HISTORY_FIELDS; ++i)
+  {
+    Serial_csv();
+    if (s.v[i] == HISTORY_NONE)
+      Serial_char('U');
+    else
+      SerialX.print(s.v[i], DEC);
+  }
+  Serial_nl();
+  g_HistoryDumping = seq != g_HistoryDumpEnd;
+}
 
 typedef void (*csv_int_callback_t)(unsigned char idx, int val);
 
@@ -798,12 +1522,14 @@ void storeLidParam(unsigned char idx, int val)
   switch (idx)
   {
     case 0:
-      pid.LidOpenOffset = val;
       config_store_byte(lidOpenOffset, val);
+      if (!g_ConfigTxnOpen)
+        pid.LidOpenOffset = val;
       break;
     case 1:
-      pid.setLidOpenDuration(val);
       config_store_word(lidOpenDuration, val);
+      if (!g_ConfigTxnOpen)
+        pid.setLidOpenDuration(val);
       break;
     case 2:
       if (val)
@@ -819,15 +1545,24 @@ void storeLidParam(unsigned char idx, int val)
 static void storeAlarmLimits(unsigned char idx, int val)
 {
   unsigned char probeIndex = ALARM_ID_TO_PROBE(idx);
+  if (probeIndex >= TEMP_COUNT)
+    return;
   ProbeAlarm &a = pid.Probes[probeIndex]->Alarms;
   unsigned char alarmIndex = ALARM_ID_TO_IDX(idx);
-  a.setThreshold(alarmIndex, val);
-
-  unsigned char ofs = getProbeConfigOffset(probeIndex, offsetof( __eeprom_probe, alarmLow));
-  if (ofs != 0 && val != 0)
+  // 0 only silences, the threshold is unchanged, so it is never staged
+  if (val == 0)
+    a.setThreshold(alarmIndex, val);
+  else if (g_ConfigTxnOpen)
   {
-    ofs += alarmIndex * sizeof(val);
-    eeprom_write_block(&val, (void *)ofs, sizeof(val));
+    int16_t threshold = val;
+    txnStageProbe(probeIndex, (alarmIndex == ALARM_IDX_LOW) ?
+      offsetof(__eeprom_probe, alarmLow) : offsetof(__eeprom_probe, alarmHigh),
+      &threshold, sizeof(threshold));
+  }
+  else
+  {
+    a.setThreshold(alarmIndex, val);
+    probeConfigDirty(probeIndex);
   }
 }
 
@@ -862,9 +1597,33 @@ static void storeFanParams(unsigned char idx, int val)
     case 4:
       storeInvertPidOutput(val);
       break;
+    case 5:
+      storeServoStepMax(val);
+      break;
   }
 }
 
+static void reportSubscription(void)
+{
+  print_P(PSTR("HMSB"));
+  for (unsigned char i=0; i<SUB_COUNT; ++i)
+  {
+    Serial_csv();
+    SerialX.print(g_SubInterval[i], DEC);
+  }
+  Serial_nl();
+}
+
+static void storeSubscription(unsigned char idx, int val)
+{
+  if (idx >= SUB_COUNT)
+    return;
+  g_SubInterval[idx] = constrain(val, 0, 255);
+  g_Subscribed = true;
+  // Everything goes out on the next period, the status as a keyframe
+  memset(g_SubElapsed, 0xff, sizeof(g_SubElapsed));
+}
+
 static void setTempParam(unsigned char idx, int val)
 {
   switch (idx)
@@ -875,71 +1634,305 @@ static void setTempParam(unsigned char idx, int val)
   }
 }
 
-static void handleCommandUrl(char *URL)
+// Puts the base config into effect, all but the setpoint, manual mode, PID
+// constants and units, which have more to them than setting a value
+static void configApply(void)
 {
-  unsigned char urlLen = strlen(URL);
-  if (strncmp_P(URL, PSTR("set?sp="), 7) == 0) 
-  {
-    storeSetPoint(atoi(URL + 7));
-    storePidUnits(URL[urlLen-1]);
-  }
-  else if (strncmp_P(URL, PSTR("set?lb="), 7) == 0)
-  {
-    csvParseI(URL + 7, storeLcdParam);
-    reportLcdParameters();
-  }
-  else if (strncmp_P(URL, PSTR("set?ld="), 7) == 0)
-  {
-    csvParseI(URL + 7, storeLidParam);
-    reportLidParameters();
-  }
-  else if (strncmp_P(URL, PSTR("set?po="), 7) == 0)
-  {
-    csvParseI(URL + 7, storeProbeOffset);
-    reportProbeOffsets();
-  }
-  else if (strncmp_P(URL, PSTR("set?pid"), 7) == 0 && urlLen > 9)
-  {
-    float f = atof(URL + 9);
-    storePidParam(URL[7], f);
-    reportPidParams();
-  }
-  else if (strncmp_P(URL, PSTR("set?pn"), 6) == 0 && urlLen > 8)
-  {
-    // Store probe name will only store it if a valid probe number is passed
-    storeAndReportProbeName(URL[6] - '0', URL + 8);
-  }
-  else if (strncmp_P(URL, PSTR("set?pc"), 6) == 0 && urlLen > 8)
-  {
-    storeProbeCoeff(URL[6] - '0', URL + 8);
-  }
-  else if (strncmp_P(URL, PSTR("set?al="), 7) == 0)
+  pid.LidOpenOffset = g_Config.lidOpenOffset;
+  pid.setLidOpenDuration(g_Config.lidOpenDuration);
+  setLcdBacklight(g_Config.lcdBacklight);
+#ifdef HEATERMETER_RFM12
+  memcpy(rfMap, g_Config.rfMap, sizeof(rfMap));
+#endif
+  pid.setMinFanSpeed(g_Config.minFanSpeed);
+  pid.setMaxFanSpeed(g_Config.maxFanSpeed);
+  pid.setOutputFlags(g_Config.pidOutputFlags);
+  g_HomeDisplayMode = g_Config.homeDisplayMode;
+  pid.setMinServoPos(g_Config.minServoPos);
+  pid.setMaxServoPos(g_Config.maxServoPos);
+  pid.setServoStepMax(g_Config.servoStepMax);
+
+  for (unsigned char led = 0; led<LED_COUNT; ++led)
+    ledmanager.setAssignment(led, g_Config.ledConf[led]);
+}
+
+// Checks the staged records as a whole, the store functions have already
+// limited the single values
+static boolean configTxnValid(void)
+{
+  if (g_ConfigTxnTouched & TXN_BASE)
   {
-    csvParseI(URL + 7, storeAlarmLimits);
-    reportAlarmLimits();
+    struct __eeprom_data cfg;
+    baseStore.readStaged(&cfg, 0, sizeof(cfg));
+    if (cfg.minFanSpeed > cfg.maxFanSpeed ||
+      cfg.minServoPos > cfg.maxServoPos ||
+      cfg.lidOpenOffset > 100)
+      return false;
   }
-  else if (strncmp_P(URL, PSTR("set?fn="), 7) == 0)
+  for (unsigned char i=0; i<TEMP_COUNT; ++i)
   {
-    csvParseI(URL + 7, storeFanParams);
-    reportFanParams();
+    if ((g_ConfigTxnTouched & (1 << i)) == 0)
+      continue;
+    struct __eeprom_probe probe;
+    probeStore.readStaged(&probe, 0, sizeof(probe), i);
+    if (probe.probeType > PROBETYPE_TC_ANALOG ||
+      probe.filterMode > PROBEFILTER_MEDIAN)
+      return false;
+    // Rknown divides the ADC reading
+    if (probe.probeType == PROBETYPE_INTERNAL && probe.steinhart[3] == 0.0f)
+      return false;
   }
-  else if (strncmp_P(URL, PSTR("set?tt="), 7) == 0)
+  return true;
+}
+
+// Puts the staged records into effect, their older copies already hold
+// them so eepromCommit() only has to finish those
+static void configTxnApply(void)
+{
+  for (unsigned char i=0; i<TEMP_COUNT; ++i)
   {
-    Menus.displayToast(URL+7);
+    if ((g_ConfigTxnTouched & (1 << i)) == 0)
+      continue;
+    struct __eeprom_probe probe;
+    probeStore.readStaged(&probe, 0, sizeof(probe), i);
+    TempProbe *p = pid.Probes[i];
+    // Not loadConfig(), that would disarm alarms that didn't change
+    memcpy(p->Steinhart, probe.steinhart, sizeof(p->Steinhart));
+    if (probe.probeType != p->getProbeType())
+      p->setProbeType(probe.probeType);
+    else
+      p->calcLut();
+    p->Offset = probe.tempOffset;
+    p->setFilterMode(probe.filterMode);
+    if (probe.alarmLow != p->Alarms.getLow())
+      p->Alarms.setLow(probe.alarmLow);
+    if (probe.alarmHigh != p->Alarms.getHigh())
+      p->Alarms.setHigh(probe.alarmHigh);
+    // The staged copy has the name too
+    g_ProbeNamePending |= 1 << i;
   }
-  else if (strncmp_P(URL, PSTR("set?tp="), 7) == 0)
+  g_ProbeDirty |= g_ConfigTxnTouched & TXN_PROBES;
+
+  if (g_ConfigTxnTouched & TXN_BASE)
   {
-    csvParseI(URL + 7, setTempParam);
+    struct __eeprom_data cfg;
+    baseStore.readStaged(&cfg, 0, sizeof(cfg));
+    // Only a changed constant resets the integral
+    for (unsigned char k=0; k<4; ++k)
+      if (cfg.pidConstants[k] != g_Config.pidConstants[k])
+        pid.setPidConstant(k, cfg.pidConstants[k]);
+    if (cfg.pidUnits != g_Config.pidUnits)
+      pid.setUnits(cfg.pidUnits);
+    // If we're in home, clear in case we're switching from 4 to 2
+    if (cfg.homeDisplayMode != g_Config.homeDisplayMode && isMenuHomeState())
+      lcd.clear();
+#ifdef HEATERMETER_RFM12
+    // A probe moved to another source starts over, like storeProbeTypeOrMap()
+    for (unsigned char i=0; i<TEMP_COUNT; ++i)
+      if (cfg.rfMap[i] != rfMap[i] && pid.Probes[i]->getProbeType() == PROBETYPE_RF12)
+        pid.Probes[i]->setProbeType(PROBETYPE_RF12);
+#endif /* HEATERMETER_RFM12 */
+
+    // The setpoint and manual mode only change through storeSetPoint()
+    int sp = cfg.setPoint;
+    cfg.setPoint = g_Config.setPoint;
+    cfg.manualMode = g_Config.manualMode;
+    g_Config = cfg;
+    configDirty(0, sizeof(g_Config));
+    configApply();
+    if (g_ConfigTxnTouched & TXN_SETPOINT)
+      storeSetPoint(sp);
   }
-  else if (strncmp_P(URL, PSTR("config"), 6) == 0)
+#ifdef HEATERMETER_RFM12
+  checkInitRfManager();
+#endif
+}
+
+static void configTxnBegin(void)
+{
+  g_ConfigTxnOpen = true;
+  g_ConfigTxnMillis = millis();
+}
+
+static void configTxnEnd(boolean commit)
+{
+  if (!g_ConfigTxnOpen)
+    return;
+  g_ConfigTxnOpen = false;
+
+  if (commit && configTxnValid())
+    configTxnApply();
+  else
   {
-    reportConfig();
+    // Nothing staged took effect, the copies are rewritten from what did
+    if (g_ConfigTxnTouched & TXN_BASE)
+      configDirty(0, sizeof(g_Config));
+    g_ProbeDirty |= g_ConfigTxnTouched & TXN_PROBES;
+    Debug_begin(); print_P(PSTR("Config discarded")); Debug_end();
   }
-  else if (strncmp_P(URL, PSTR("reboot"), 5) == 0)
+  g_ConfigTxnTouched = 0;
+  // Written in one go rather than waiting out CONFIG_COMMIT_DELAY
+  g_ConfigDirtyMillis = millis() - CONFIG_COMMIT_DELAY;
+  // One report of everything in place of each setter's own
+  reportConfig();
+}
+
+// Called every loop, an abandoned transaction is discarded
+static void checkConfigTxn(void)
+{
+  if (g_ConfigTxnOpen && millis() - g_ConfigTxnMillis > CONFIG_TXN_TIMEOUT)
+    configTxnEnd(false);
+}
+
+// Command handlers get the URL past the command name
+typedef void (*command_func_t)(char *args);
+typedef void (*report_func_t)(void);
+
+typedef struct tagCommandDef
+{
+  char name[9];
+  command_func_t func;
+  report_func_t report;  // after func, held while a transaction is open
+} command_def_t;
+
+static void cmdSetPoint(char *args)
+{
+  unsigned char len = strlen(args);
+  storeSetPoint(atoi(args));
+  if (len != 0)
+    storePidUnits(args[len-1]);
+}
+
+static void cmdLcdParams(char *args) { csvParseI(args, storeLcdParam); }
+static void cmdLidParams(char *args) { csvParseI(args, storeLidParam); }
+static void cmdProbeOffsets(char *args) { csvParseI(args, storeProbeOffset); }
+static void cmdProbeFilters(char *args) { csvParseI(args, storeProbeFilter); }
+static void cmdAlarmLimits(char *args) { csvParseI(args, storeAlarmLimits); }
+static void cmdFanParams(char *args) { csvParseI(args, storeFanParams); }
+static void cmdTempParams(char *args) { csvParseI(args, setTempParam); }
+static void cmdSubscribe(char *args) { csvParseI(args, storeSubscription); }
+
+// pidX=val
+static void cmdPidParam(char *args)
+{
+  if (strlen(args) > 2)
+    storePidParam(args[0], atof(args + 2));
+}
+
+// pnN=name, a bad N just reports the names
+static void cmdProbeName(char *args)
+{
+  if (strlen(args) > 2)
+    storeProbeName(args[0] - '0', args + 2);
+}
+
+// pcN=vals
+static void cmdProbeCoeff(char *args)
+{
+  if (strlen(args) > 2)
+    storeProbeCoeff(args[0] - '0', args + 2);
+}
+
+#if defined(GRILLPID_AUTOTUNE_ENABLED)
+static void cmdAutotune(char *args)
+{
+  if (atoi(args))
+    pid.startAutotune();
+  else
+    pid.stopAutotune();
+}
+#endif /* GRILLPID_AUTOTUNE_ENABLED */
+
+static void cmdCookProgram(char *args) { storeCookProgram(args); }
+
+// 1-based step to start at, 0 stops
+static void cmdCookRun(char *args) { setCookStep(atoi(args) - 1); }
+
+static void cmdSerialMode(char *args) { SerialX.setBinary(atoi(args)); }
+static void cmdToast(char *args) { Menus.displayToast(args); }
+
+// 1 opens a transaction, 0 commits it, -1 discards it
+static void cmdConfigTxn(char *args)
+{
+  int op = atoi(args);
+  if (op > 0)
+    configTxnBegin();
+  else
+    configTxnEnd(op == 0);
+}
+
+static void cmdConfig(char *args) { reportConfig(); }
+static void cmdTasks(char *args) { reportTaskStats(); }
+static void cmdHistory(char *args) { reportHistory(); }
+// reboot doesn't return
+static void cmdReboot(char *args) { reboot(); }
+
+// Sorted by name for findCommand(), and no name may be the start of another
+static const command_def_t COMMANDS[] PROGMEM = {
+  { "config", cmdConfig, NULL },
+  { "history", cmdHistory, NULL },
+  { "reboot", cmdReboot, NULL },
+  { "set?al=", cmdAlarmLimits, reportAlarmLimits },
+#if defined(GRILLPID_AUTOTUNE_ENABLED)
+  { "set?at=", cmdAutotune, reportAutotune },
+#endif /* GRILLPID_AUTOTUNE_ENABLED */
+  { "set?cfg=", cmdConfigTxn, NULL },
+  { "set?cp=", cmdCookProgram, NULL },
+  { "set?cr=", cmdCookRun, NULL },
+  { "set?fn=", cmdFanParams, reportFanParams },
+  { "set?lb=", cmdLcdParams, reportLcdParameters },
+  { "set?ld=", cmdLidParams, reportLidParameters },
+  { "set?pc", cmdProbeCoeff, NULL },
+  { "set?pf=", cmdProbeFilters, reportProbeFilters },
+  { "set?pid", cmdPidParam, reportPidParams },
+  { "set?pn", cmdProbeName, reportProbeNames },
+  { "set?po=", cmdProbeOffsets, reportProbeOffsets },
+  { "set?sb=", cmdSubscribe, reportSubscription },
+  { "set?sm=", cmdSerialMode, reportSerialMode },
+  { "set?sp=", cmdSetPoint, NULL },
+  { "set?tp=", cmdTempParams, NULL },
+  { "set?tt=", cmdToast, NULL },
+  { "tasks", cmdTasks, NULL },
+};
+#define COMMAND_COUNT (sizeof(COMMANDS)/sizeof(COMMANDS[0]))
+
+// Binary search on the URL up to the length of each name, sets nameLen
+static const command_def_t *findCommand(const char *URL, unsigned char *nameLen)
+{
+  unsigned char lo = 0;
+  unsigned char hi = COMMAND_COUNT;
+  while (lo < hi)
   {
-    reboot();
-    // reboot doesn't return
+    unsigned char mid = (lo + hi) / 2;
+    const char *name = COMMANDS[mid].name;
+    unsigned char len = strlen_P(name);
+    int cmp = strncmp_P(URL, name, len);
+    if (cmp == 0)
+    {
+      *nameLen = len;
+      return &COMMANDS[mid];
+    }
+    if (cmp < 0)
+      hi = mid;
+    else
+      lo = mid + 1;
   }
+  return NULL;
+}
+
+static void handleCommandUrl(char *URL)
+{
+  unsigned char nameLen;
+  const command_def_t *cmd = findCommand(URL, &nameLen);
+  if (cmd == NULL)
+    return;
+
+  if (g_ConfigTxnOpen)
+    g_ConfigTxnMillis = millis();
+  ((command_func_t)pgm_read_word(&cmd->func))(URL + nameLen);
+  report_func_t report = (report_func_t)pgm_read_word(&cmd->report);
+  if (report != NULL && !g_ConfigTxnOpen)
+    report();
 }
 #endif /* defined(HEATERMETER_SERIAL) */
 
@@ -947,9 +1940,23 @@ static void outputRfStatus(void)
 {
 #if defined(HEATERMETER_SERIAL) && defined(HEATERMETER_RFM12)
   rfmanager.status();
+  rfmanager.remoteStatus();
 #endif /* defined(HEATERMETER_SERIAL) && defined(HEATERMETER_RFM12) */
 }
 
+static void outputProbeRejects(void)
+{
+#if defined(HEATERMETER_SERIAL)
+  print_P(PSTR("HMPR"));
+  for (unsigned char i=0; i<TEMP_COUNT; ++i)
+  {
+    Serial_csv();
+    SerialX.print(pid.Probes[i]->getRejected(), DEC);
+  }
+  Serial_nl();
+#endif /* HEATERMETER_SERIAL */
+}
+
 #ifdef HEATERMETER_RFM12
 static void rfSourceNotify(RFSource &r, unsigned char event)
 {
@@ -961,7 +1968,7 @@ static void rfSourceNotify(RFSource &r, unsigned char event)
       if (event == RFEVENT_Remove)
         pid.Probes[i]->addAdcValue(0);
       else if (r.isNative())
-        pid.Probes[i]->setTemperatureC(r.Value / 10.0f);
+        pid.Probes[i]->setTemperatureC10(r.Value);
       else
       {
         unsigned int val = r.Value;
@@ -978,6 +1985,57 @@ static void rfSourceNotify(RFSource &r, unsigned char event)
 }
 #endif /* HEATERMETER_RFM12 */
 
+// Everything from the end of .bss up is painted before main() so the deepest
+// the stack has reached can be found later. 0xc5 rarely shows up in real data.
+#define STACK_PAINT 0xc5
+extern unsigned char __data_start, __data_end, __bss_start, __bss_end, __heap_start;
+extern void *__brkval;
+static unsigned char *g_StackLow = (unsigned char *)RAMEND; // deepest stack byte seen
+
+// Runs with nothing on the stack and before .bss is cleared, so it may
+// only touch memory above it
+__attribute__((naked)) __attribute__((section(".init3")))
+  void paintStack(void)
+{
+  for (unsigned char *p = &__heap_start; p <= (unsigned char *)RAMEND; ++p)
+    *p = STACK_PAINT;
+}
+
+static unsigned char *heapEnd(void)
+{
+  return (__brkval != 0) ? (unsigned char *)__brkval : &__heap_start;
+}
+
+// The first byte above the heap that isn't paint is the deepest the stack
+// has been. The heap can only grow into paint so this never moves up.
+static void mem_doWork(void)
+{
+  unsigned char *p = heapEnd();
+  while (p < g_StackLow && *p == STACK_PAINT)
+    ++p;
+  g_StackLow = p;
+}
+
+static void outputMemStats(void)
+{
+#if defined(HEATERMETER_SERIAL)
+  unsigned char sp;
+  print_P(PSTR("HMMS" CSV_DELIMITER));
+  SerialX.print(&__data_end - &__data_start, DEC);
+  Serial_csv();
+  SerialX.print(&__bss_end - &__bss_start, DEC);
+  Serial_csv();
+  SerialX.print(heapEnd() - &__heap_start, DEC);
+  Serial_csv();
+  SerialX.print(&sp - heapEnd(), DEC);
+  Serial_csv();
+  SerialX.print(g_StackLow - heapEnd(), DEC);
+  Serial_csv();
+  SerialX.print((unsigned char *)RAMEND - g_StackLow + 1, DEC);
+  Serial_nl();
+#endif /* HEATERMETER_SERIAL */
+}
+
 static void tone_doWork(void)
 {
 #ifdef PIEZO_HZ
@@ -1030,86 +2088,162 @@ static void checkAlarms(void)
     Menus.setState(ST_HOME_FOOD1);
 }
 
-static void eepromLoadBaseConfig(unsigned char forceDefault)
+static void probeDefaultConfig(unsigned char probeIndex, struct __eeprom_probe *probe)
+{
+  memcpy_P(probe, &DEFAULT_PROBE_CONFIG, sizeof(__eeprom_probe));
+  // Hardcoded to change the last character of the string instead of [strlen(config.name)-1]
+  probe->name[6] = '0' + probeIndex;
+}
+
+// Version 0 to 1: the base config and probe structs became two copies with
+// their own generation and CRC, the cook program and the hot slot ring were
+// added, and the unused byte (0xff) became servoStepMax. Version 0 only
+// stored the probes once their magic was written.
+static void eepromMigrateV0(void)
 {
-  // The compiler likes to join eepromLoadBaseConfig and eepromLoadProbeConfig s
-  // this union saves stack space by reusing the same memory area for both structs
   union {
     struct __eeprom_data base;
     struct __eeprom_probe probe;
   } config;
 
-  eeprom_read_block(&config.base, 0, sizeof(__eeprom_data));
-  forceDefault = forceDefault || config.base.magic != EEPROM_MAGIC;
+  boolean probesValid = eeprom_read_word((uint16_t *)(EEPROM_PROBE_V0_START - 2)) == EEPROM_MAGIC_V0;
+  const unsigned char *ofs = (const unsigned char *)EEPROM_PROBE_V0_START;
+  for (unsigned char i=0; i<TEMP_COUNT; ++i, ofs += sizeof(__eeprom_probe))
+  {
+    if (probesValid)
+      eeprom_read_block(&config.probe, ofs, sizeof(__eeprom_probe));
+    else
+      probeDefaultConfig(i, &config.probe);
+    probeStore.storeAll(&config.probe, i);
+  }
+
+  eeprom_write_byte(cookprog_addr(activeStep), COOKPROG_STOPPED);
+  eeprom_write_byte(cookprog_addr(stepCount), 0);
+
+  // Whatever version 0 left in the ring would pass for a slot now and then
+  struct __eeprom_hotslot slot;
+  for (unsigned char i=0; i<HOTSLOT_COUNT; ++i)
+  {
+    eeprom_read_block(&slot, hotslot_addr(i), sizeof(slot));
+    if (slot.crc == hotSlotCrc(&slot))
+      eeprom_write_byte(hotslot_addr(i) + offsetof(__eeprom_hotslot, crc), ~slot.crc);
+  }
+
+  // The base config goes last. The header is only read once the magic at the
+  // start of copy A changes, and storeAll() writes that copy after B.
+  eeprom_read_block(&config.base, (const void *)EEPROM_BASE_A_START, sizeof(__eeprom_data));
+  if (config.base.servoStepMax == 0xff)
+    config.base.servoStepMax = 0;
+  config.base.magic = EEPROM_MAGIC;
+  eeprom_write_byte(header_addr(version), 1);
+  baseStore.storeAll(&config.base);
+}
+
+// Entry N upgrades the layout from version N to N+1 in place. Each must be
+// safe to run again, the version is only stored after they all finish.
+typedef void (*eeprom_migration_t)(void);
+static const eeprom_migration_t EEPROM_MIGRATIONS[EEPROM_SCHEMA_VERSION] PROGMEM = {
+  eepromMigrateV0,
+};
+
+// Brings an older layout up to EEPROM_SCHEMA_VERSION, false if the EEPROM
+// doesn't hold a layout this firmware knows
+static boolean eepromMigrate(void)
+{
+  unsigned char version;
+  unsigned int magic = eeprom_read_word((uint16_t *)(EEPROM_BASE_A_START + offsetof(__eeprom_data, magic)));
+  if (magic == EEPROM_MAGIC_V0)
+    version = 0;
+  else if (magic == EEPROM_MAGIC)
+    version = eeprom_read_byte(header_addr(version));
+  else
+    return false;
+
+  if (version > EEPROM_SCHEMA_VERSION)
+    return false;
+  if (version == EEPROM_SCHEMA_VERSION)
+    return true;
+
+  while (version < EEPROM_SCHEMA_VERSION)
+    ((eeprom_migration_t)pgm_read_word(&EEPROM_MIGRATIONS[version++]))();
+  eeprom_write_byte(header_addr(version), EEPROM_SCHEMA_VERSION);
+  return true;
+}
+
+static void eepromLoadBaseConfig(unsigned char forceDefault)
+{
+  forceDefault = forceDefault || !baseStore.load(&g_Config) ||
+    g_Config.magic != EEPROM_MAGIC;
+  // Always find the newest slot so the next one written follows it
+  boolean hotSlotValid = eepromLoadHotSlot();
   if (forceDefault != 0)
   {
-    memcpy_P(&config.base, &DEFAULT_CONFIG[forceDefault - 1], sizeof(__eeprom_data));
-    eeprom_write_block(&config.base, 0, sizeof(__eeprom_data));
+    memcpy_P(&g_Config, &DEFAULT_CONFIG[forceDefault - 1], sizeof(__eeprom_data));
+    baseStore.storeAll(&g_Config);
+    g_ConfigDirtyLo = 0xff;
+    g_ConfigDirtyHi = 0;
+    // The defaults need a slot newer than any existing one
+    g_HotSlotDirty = true;
+    eepromFlush();
+  }
+  else if (hotSlotValid)
+  {
+    g_Config.setPoint = g_HotSlot.setPoint;
+    g_Config.manualMode = g_HotSlot.manualMode;
   }
   
-  pid.setSetPoint(config.base.setPoint);
-  pid.LidOpenOffset = config.base.lidOpenOffset;
-  pid.setLidOpenDuration(config.base.lidOpenDuration);
-  memcpy(pid.Pid, config.base.pidConstants, sizeof(config.base.pidConstants));
-  if (config.base.manualMode)
+  pid.setSetPoint(g_Config.setPoint);
+  memcpy(pid.Pid, g_Config.pidConstants, sizeof(g_Config.pidConstants));
+  if (g_Config.manualMode)
     pid.setPidOutput(0);
-  setLcdBacklight(config.base.lcdBacklight);
-#ifdef HEATERMETER_RFM12
-  memcpy(rfMap, config.base.rfMap, sizeof(rfMap));
-#endif
-  pid.setUnits(config.base.pidUnits == 'C' ? 'C' : 'F');
-  pid.setMinFanSpeed(config.base.minFanSpeed);
-  pid.setMaxFanSpeed(config.base.maxFanSpeed);
-  pid.setOutputFlags(config.base.pidOutputFlags);
-  g_HomeDisplayMode = config.base.homeDisplayMode;
-  pid.setMinServoPos(config.base.minServoPos);
-  pid.setMaxServoPos(config.base.maxServoPos);
-
-  for (unsigned char led = 0; led<LED_COUNT; ++led)
-    ledmanager.setAssignment(led, config.base.ledConf[led]);
+  pid.setUnits(g_Config.pidUnits == 'C' ? 'C' : 'F');
+  configApply();
 }
 
 static void eepromLoadProbeConfig(unsigned char forceDefault)
 {
-  // The compiler likes to join eepromLoadBaseConfig and eepromLoadProbeConfig s
-  // this union saves stack space by reusing the same memory area for both structs
-  union {
-    struct __eeprom_data base;
-    struct __eeprom_probe probe;
-  } config;
-
-  // instead of this use below because we don't have eeprom_read_word linked yet
-  //magic = eeprom_read_word((uint16_t *)(EEPROM_PROBE_START-sizeof(magic))); 
-  eeprom_read_block(&config.base, (void *)(EEPROM_PROBE_START-sizeof(config.base.magic)), sizeof(config.base.magic));
-  if (config.base.magic != EEPROM_MAGIC)
-  {
-    forceDefault = 1;
-    eeprom_write_word((uint16_t *)(EEPROM_PROBE_START-sizeof(config.base.magic)), EEPROM_MAGIC);
-  }
-    
-  struct  __eeprom_probe *p;
-  p = (struct  __eeprom_probe *)(EEPROM_PROBE_START);
+  struct __eeprom_probe probe;
   for (unsigned char i=0; i<TEMP_COUNT; ++i)
   {
-    if (forceDefault != 0)
+    // Only a probe with neither copy valid goes back to defaults
+    if (forceDefault != 0 || !probeStore.load(&probe, i))
     {
-      memcpy_P(&config.probe, &DEFAULT_PROBE_CONFIG, sizeof( __eeprom_probe));
-      // Hardcoded to change the last character of the string instead of [strlen(config.name)-1]
-      config.probe.name[6] = '0' + i;
-      eeprom_write_block(&config.probe, p, sizeof(__eeprom_probe));
+      probeDefaultConfig(i, &probe);
+      probeStore.storeAll(&probe, i);
     }
-    else
-      eeprom_read_block(&config.probe, p, sizeof(__eeprom_probe));
-
-    pid.Probes[i]->loadConfig(&config.probe);
-    ++p;
+    pid.Probes[i]->loadConfig(&probe);
   }  /* for i<TEMP_COUNT */
 }
 
+static void eepromLoadCookProgram(unsigned char forceDefault)
+{
+  if (forceDefault != 0)
+  {
+    eeprom_write_byte(cookprog_addr(activeStep), COOKPROG_STOPPED);
+    eeprom_write_byte(cookprog_addr(stepCount), 0);
+  }
+
+  // Pick up where we left off, the base config already has the step's setpoint.
+  // Time triggers start over
+  eeprom_read_block(&g_CookProg, cookprog_addr(activeStep), sizeof(g_CookProg));
+  // Never written
+  if (g_CookProg.stepCount > COOKPROG_STEP_COUNT)
+    g_CookProg.stepCount = 0;
+  if (g_CookProg.activeStep >= g_CookProg.stepCount)
+    g_CookProg.activeStep = COOKPROG_STOPPED;
+  g_CookStepStart = millis();
+}
+
 void eepromLoadConfig(unsigned char forceDefault)
 {
+  // A layout that can't be migrated is entirely reset
+  if (!eepromMigrate() && forceDefault == 0)
+    forceDefault = 1;
+  if (forceDefault != 0)
+    eeprom_write_byte(header_addr(version), EEPROM_SCHEMA_VERSION);
   eepromLoadBaseConfig(forceDefault);
   eepromLoadProbeConfig(forceDefault);
+  eepromLoadCookProgram(forceDefault);
 }
 
 static void blinkLed(void)
@@ -1142,6 +2276,9 @@ static void serial_doWork(void)
     }
     g_SerialBuff[len] = '\0';
   }  /* while Serial */
+
+  reportConfigStep();
+  reportHistoryStep();
 }
 #endif  /* HEATERMETER_SERIAL */
 
@@ -1151,22 +2288,55 @@ void Debug_begin(void)
     print_P(PSTR("HMLG" CSV_DELIMITER "0" CSV_DELIMITER));
 }
 
+// Every HISTORY_PERIOD temperature periods. pidCycleCount wraps at 256, which
+// isn't a multiple of the period, so it has its own count
+static void recordHistory(void)
+{
+  static unsigned char periods;
+  if (++periods < HISTORY_PERIOD)
+    return;
+  periods = 0;
+
+  history_sample_t s;
+  s.v[0] = pid.getSetPoint();
+  for (unsigned char i=0; i<TEMP_COUNT; ++i)
+  {
+    if (pid.Probes[i]->hasTemperature())
+      s.v[1 + i] = lround(pid.Probes[i]->Temperature);
+    else
+      s.v[1 + i] = HISTORY_NONE;
+  }
+  s.v[5] = pid.getPidOutput();
+  history.add(s);
+}
+
 static void newTempsAvail(void)
 {
   static unsigned char pidCycleCount;
 
   updateDisplay();
   ++pidCycleCount;
+  subscriptionTick();
     
-  if ((pidCycleCount % 0x20) == 0)
+  if (g_Subscribed ? subscriptionTake(SUB_RF) : (pidCycleCount % 0x20) == 0)
     outputRfStatus();
+  if ((pidCycleCount % 0x20) == 0)
+  {
+    outputProbeRejects();
+    outputMemStats();
+  }
+  recordHistory();
 
   outputCsv();
+  checkCookProgram();
+#if defined(GRILLPID_AUTOTUNE_ENABLED)
+  checkAutotune();
+#endif
   // We want to report the status before the alarm readout so
   // receivers can tell what the value was that caused the alarm
   checkAlarms();
 
-  if (g_LogPidInternals)
+  if (g_LogPidInternals && (!g_Subscribed || subscriptionTake(SUB_PIDINT)))
     pid.pidStatus();
 
   ledmanager.publish(LEDSTIMULUS_Off, LEDACTION_Off);
@@ -1242,20 +2412,85 @@ void hmcoreSetup(void)
   Menus.setState(ST_HOME_NOPROBES);
 }
 
-void hmcoreLoop(void)
-{ 
-#ifdef HEATERMETER_SERIAL 
-  serial_doWork();
-#endif /* HEATERMETER_SERIAL */
+static void pid_doWork(void)
+{
+  if (pid.doWork())
+    newTempsAvail();
+}
 
 #ifdef HEATERMETER_RFM12
+static void rf_doWork(void)
+{
   if (rfmanager.doWork())
     ledmanager.publish(LEDSTIMULUS_RfReceive, LEDACTION_OneShot);
+}
 #endif /* HEATERMETER_RFM12 */
 
+static void menus_doWork(void)
+{
   Menus.doWork();
-  if (pid.doWork())
-    newTempsAvail();
-  tone_doWork();
+}
+
+static void led_doWork(void)
+{
   ledmanager.doWork();
 }
+
+static void eeprom_doWork(void)
+{
+#ifdef HEATERMETER_SERIAL
+  checkConfigTxn();
+#endif /* HEATERMETER_SERIAL */
+  eepromCommit();
+}
+
+// Deadlines are generous, they only count as overruns in $HMTS. pid_doWork
+// includes newTempsAvail() which redraws the LCD and sends the status.
+static const task_def_t TASKS[] PROGMEM = {
+  // func, period ms, deadline us, priority
+  { pid_doWork, 0, 10000, 0 },
+#ifdef HEATERMETER_SERIAL
+  { serial_doWork, 0, 2000, 1 },
+#endif /* HEATERMETER_SERIAL */
+#ifdef HEATERMETER_RFM12
+  { rf_doWork, 0, 1000, 1 },
+#endif /* HEATERMETER_RFM12 */
+  { eeprom_doWork, 0, 500, 2 },
+  { menus_doWork, 10, 5000, 3 },
+  { tone_doWork, 10, 500, 3 },
+  { led_doWork, 50, 500, 4 },
+  { mem_doWork, 1000, 500, 4 },
+};
+static TaskScheduler tasks(TASKS, sizeof(TASKS)/sizeof(TASKS[0]));
+// Past TASK_MAX the scheduler would drop tasks, fails to compile instead
+typedef char tasks_fit[(sizeof(TASKS)/sizeof(TASKS[0]) <= TASK_MAX) ? 1 : -1];
+
+// Times since the last report, which starts a new window
+static void reportTaskStats(void)
+{
+#ifdef HEATERMETER_SERIAL
+  print_P(PSTR("HMTS" CSV_DELIMITER));
+  SerialX.print(tasks.getLoopAvg(), DEC);
+  Serial_csv();
+  SerialX.print(tasks.getLoopWorst(), DEC);
+  Serial_csv();
+  SerialX.print(tasks.getLoopJitter(), DEC);
+  for (unsigned char i=0; i<tasks.getTaskCount(); ++i)
+  {
+    const task_stats_t &s = tasks.getStats(i);
+    Serial_csv();
+    SerialX.print(s.worst, DEC);
+    Serial_csv();
+    SerialX.print(s.runs ? s.total / s.runs : 0, DEC);
+    Serial_csv();
+    SerialX.print(s.overruns, DEC);
+  }
+  Serial_nl();
+#endif /* HEATERMETER_SERIAL */
+  tasks.resetStats();
+}
+
+void hmcoreLoop(void)
+{
+  tasks.doWork();
+}
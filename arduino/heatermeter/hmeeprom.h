@@ -0,0 +1,43 @@
+// HeaterMeter Copyright 2013 Bryan Mayland <bmayland@capnbry.net>
+#ifndef __HMEEPROM_H__
+#define __HMEEPROM_H__
+
+#include <Arduino.h>
+#include "grillpid_conf.h"
+#include "ledmanager.h"
+
+// The base config as stored in the EEPROM. rfMap is only there if hmcore.h
+// enables HEATERMETER_RFM12, so that has to be included first. Fixed width
+// and packed, the AVR layout anyway, so the hmsim host build matches it.
+struct __attribute__((packed)) __eeprom_data {
+  uint16_t magic;
+  int16_t setPoint;
+  unsigned char lidOpenOffset;
+  uint16_t lidOpenDuration;
+  float pidConstants[4]; // constants are stored Kb, Kp, Ki, Kd
+  boolean manualMode;
+  unsigned char lcdBacklight; // in PWM (max 100)
+#ifdef HEATERMETER_RFM12
+  unsigned char rfMap[TEMP_COUNT];
+#endif
+  char pidUnits;
+  unsigned char minFanSpeed;  // in percent
+  unsigned char maxFanSpeed;  // in percent
+  unsigned char pidOutputFlags;
+  unsigned char homeDisplayMode;
+  unsigned char servoStepMax; // in usec per refresh
+  unsigned char ledConf[LED_COUNT];
+  unsigned char minServoPos;  // in percent
+  unsigned char maxServoPos;  // in percent
+};
+
+// The base config and each probe struct are kept as two copies, each
+// followed by its generation and CRC. Version 0 of the layout had a single
+// copy of the probe structs at EEPROM_PROBE_V0_START, only read to migrate.
+#define EEPROM_BASE_A_START   0x000
+#define EEPROM_PROBE_V0_START 0x040
+#define EEPROM_PROBE_A_START  0x100
+#define EEPROM_PROBE_B_START  0x1a0
+#define EEPROM_BASE_B_START   0x280
+
+#endif /* __HMEEPROM_H__ */
@@ -112,7 +112,7 @@ char editString[17];
 
 static button_t readButton(void)
 {
-  unsigned char button = analogRead(PIN_BUTTONS) >> 2;
+  unsigned char button = analogReadOver(PIN_BUTTONS, 8);
   if (button == 0)
     return BUTTON_NONE;
 
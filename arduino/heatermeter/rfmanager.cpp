@@ -1,4 +1,6 @@
 // HeaterMeter Copyright 2011 Bryan Mayland <bmayland@capnbry.net>
+#include <util/atomic.h>
+
 #include "strings.h"
 #include "rfmanager.h"
 #include "hmcore.h"
@@ -9,11 +11,17 @@ void RFSource::setId(unsigned char id)
 
   _id = id;
   Value = 0;
+  _rxCount = 0;
+  _missed = 0;
+  _crcErrors = 0;
+  _maxGap = 0;
 }
 
 boolean RFSource::update(rf12_packet_t *pkt)
 {
-  _lastReceive = millis();
+  unsigned int now = rf12_rxtime >> RF_TICK_SHIFT;
+  unsigned int gap = now - _lastReceive;
+  _lastReceive = now;
 
   unsigned char newFlags = 0;
   if ((pkt->byte1 & 0x20) != 0)
@@ -23,8 +31,29 @@ boolean RFSource::update(rf12_packet_t *pkt)
    /* Hygro value of 6A=NoHygro 7D=Secondary Unit?(TX25U) 7F=lmremote */
   if ((pkt->hygro & 0x7f) < 0x7f)
     newFlags |= RFSOURCEFLAG_NativeItPlus;
-  _flags = newFlags;
-  _rssi = rf12_rssi();
+  _flags = newFlags | (rf12_rssi() << RFSOURCE_RSSI_SHIFT);
+
+  unsigned char rssi = rf12_rssi() << RF_RSSIAVG_SHIFT;
+  if (_rxCount == 0)
+    _rssiAvg = rssi;
+  else
+  {
+    _rssiAvg = _rssiAvg + (((int)rssi - _rssiAvg) >> RF_RSSIAVG_WEIGHT);
+    // A source is freed once stale, so the gap fits
+    if (gap > _maxGap)
+      _maxGap = gap;
+    unsigned int missed;
+    if (isNative())
+    {
+      missed = (gap + RF_ITPLUS_INTERVAL / 2) / RF_ITPLUS_INTERVAL;
+      if (missed != 0)
+        --missed;
+    }
+    else
+      missed = gap / RF_LMREMOTE_MAXGAP;
+    _missed += missed;
+  }
+  ++_rxCount;
 
   if (isNative())
   {
@@ -54,14 +83,46 @@ void RFManager::init(unsigned char band)
   }
 }
 
+void RFManager::setSlotOfId(unsigned char srcId, unsigned char idx)
+{
+  unsigned char *p = &_slotOfId[srcId / 2];
+  if (srcId & 1)
+    *p = (*p & 0x0f) | (idx << 4);
+  else
+    *p = (*p & 0xf0) | idx;
+}
+
+void RFManager::freeSource(unsigned char idx)
+{
+  if (_callback) _callback(_sources[idx], RFEVENT_Remove);
+  setSlotOfId(_sources[idx].getId(), RF_SLOT_NONE);
+  _sources[idx].setId(RFSOURCEID_NONE);
+}
+
 void RFManager::freeStaleSources(void)
 {
   for (unsigned char idx=0; idx<RF_SOURCE_COUNT; ++idx)
     if (_sources[idx].isStale())
-    {
-      if (_callback) _callback(_sources[idx], RFEVENT_Remove);
-      _sources[idx].setId(RFSOURCEID_NONE);
-    }
+      freeSource(idx);
+
+  unsigned int now = millis() >> RF_TICK_SHIFT;
+  for (unsigned char i=0; i<RF_REMOTE_COUNT; ++i)
+    if (_remotes[i].id != RFSOURCEID_NONE &&
+      (unsigned int)(now - _remotes[i].lastAck) > RF_STALE_TICKS)
+      _remotes[i].id = RFSOURCEID_NONE;
+}
+
+void RFManager::setAllowed(const unsigned char *ids, unsigned char count)
+{
+  memset(_allowed, 0, sizeof(_allowed));
+  for (unsigned char i=0; i<count; ++i)
+    if (ids[i] < RF_SOURCEID_COUNT)
+      _allowed[ids[i] / 8] |= bit(ids[i] % 8);
+}
+
+boolean RFManager::isAllowed(unsigned char srcId) const
+{
+  return _allowed[srcId / 8] & bit(srcId % 8);
 }
 
 unsigned char RFManager::findFreeSourceIdx(void)
@@ -72,13 +133,44 @@ unsigned char RFManager::findFreeSourceIdx(void)
   return 0xff;
 }
 
-unsigned char RFManager::findSourceIdx(unsigned char srcId)
+unsigned char RFManager::findSourceIdx(unsigned char srcId) const
 {
   // Get the index of the srcId, returns 0xff if it doesn't exist
-  for (unsigned char idx=0; idx<RF_SOURCE_COUNT; ++idx)
-    if (_sources[idx].getId() == srcId)
+  if (srcId >= RF_SOURCEID_COUNT)
+    return 0xff;
+  unsigned char idx = _slotOfId[srcId / 2];
+  idx = (srcId & 1) ? idx >> 4 : idx & 0x0f;
+  return (idx == RF_SLOT_NONE) ? 0xff : idx;
+}
+
+// Finds a slot for a new srcId. When the table is full the source heard
+// from longest ago that isn't mapped to a probe makes room, so neighbours'
+// sensors can't push out our own. Returns 0xff if every slot is mapped.
+unsigned char RFManager::allocSourceIdx(unsigned char srcId)
+{
+  unsigned char idx = findFreeSourceIdx();
+  if (idx == 0xff)
+  {
+    unsigned int oldest = 0;
+    for (unsigned char i=0; i<RF_SOURCE_COUNT; ++i)
+    {
+      if (isAllowed(_sources[i].getId()))
+        continue;
+      unsigned int age = _sources[i].getAge();
+      if (idx == 0xff || age > oldest)
+      {
+        idx = i;
+        oldest = age;
+      }
+    }
+    if (idx == 0xff)
       return idx;
-  return 0xff;
+    freeSource(idx);
+  }
+
+  _sources[idx].setId(srcId);
+  setSlotOfId(srcId, idx);
+  return idx;
 }
 
 RFSource *RFManager::getSourceById(unsigned char srcId)
@@ -92,31 +184,61 @@ void RFManager::status(void)
   if (!_initialized)
     return;
 
-  // The first item in the list the manager RFSOURCEID_NONE,CrcOk
-  print_P(PSTR("HMRF" CSV_DELIMITER "255" CSV_DELIMITER "0" CSV_DELIMITER));
+  unsigned int overflows;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    overflows = rf12_rxoverflow;
+  }
+
+  // Always text, the link quality for every source is too big for a frame
+  // The first item in the list the manager RFSOURCEID_NONE,RxOverflows,CrcOk
+  print_P(PSTR("HMRF" CSV_DELIMITER "255" CSV_DELIMITER));
+  SerialX.print(overflows, DEC);
+  Serial_csv();
   SerialX.print(_crcOk, DEC); // signalish
   //Serial_csv();
   //unsigned long m = millis();
   //SerialX.print((m - getLastReceive()) / 1000, DEC);
 
-  // The rest of the items are Id,Flags
+  // The rest of the items are Id,Flags,Rssi then the link quality
   for (unsigned char idx=0; idx<RF_SOURCE_COUNT; ++idx)
   {
-    if (_sources[idx].isFree())
+    const RFSource &s = _sources[idx];
+    if (s.isFree())
       continue;
     Serial_csv();
-    SerialX.print(_sources[idx].getId(),DEC);
+    SerialX.print(s.getId(),DEC);
+    Serial_csv();
+    SerialX.print(s.getFlags(), DEC);
+    Serial_csv();
+    SerialX.print(s.getRssi(),DEC);
+    Serial_csv();
+    SerialX.printFixed(((unsigned int)s.getRssiAvg() * 100) >> RF_RSSIAVG_SHIFT, 2);
     Serial_csv();
-    SerialX.print(_sources[idx].getFlags(), DEC);
+    SerialX.print(s.getRxCount(), DEC);
     Serial_csv();
-    SerialX.print(_sources[idx].getRssi(),DEC);
-    //Serial_csv();
-    //unsigned int since = (m - _sources[idx].getLastReceive()) / 1000;
-    //SerialX.print(since, DEC);
+    SerialX.print(s.getMissed(), DEC);
+    Serial_csv();
+    SerialX.print(s.getCrcErrors(), DEC);
+    Serial_csv();
+    SerialX.print(((unsigned long)s.getMaxGap() << RF_TICK_SHIFT) / 1000UL, DEC);
   }
   Serial_nl();
 }
 
+void RFManager::sendCommand(unsigned char dst)
+{
+  unsigned char outbuf[5];
+  outbuf[0] = (RF_PKT_COMMAND << 4) | ((dst & 0x3f) >> 2);
+  outbuf[1] = ((dst & 0x3f) << 6);
+  outbuf[2] = _cmdVal;
+  outbuf[3] = _cmdSeq;
+  outbuf[4] = _cmdAttempt;
+
+  _cmdLastSend = millis();
+  rf12_sendStart(outbuf, sizeof(outbuf));
+}
+
 void RFManager::sendUpdate(unsigned char val)
 {
 #if RF_SEND_INTERVAL
@@ -126,25 +248,171 @@ void RFManager::sendUpdate(unsigned char val)
     return;
   _txCounter = 0;
 
-#define NODEID_MASTER      0x3F
+  // A new command replaces the last, anyone who didn't ack it never will
+  for (unsigned char i=0; i<RF_REMOTE_COUNT; ++i)
+  {
+    rf_remote_t &r = _remotes[i];
+    if (r.id == RFSOURCEID_NONE)
+      continue;
+    if (r.ackSeq != _cmdSeq)
+      ++r.failed;
+    ++r.sent;
+  }
 
-#define HYGRO_BATTERY_OK   0x00
-#define HYGRO_BATTERY_LOW  0x80
-#define HYGRO_NO_HYGRO     0x6A
-#define HYGRO_SECOND_PROBE 0x7D
-#define HYGRO_LMREMOTE_KEY 0x7F
+  ++_cmdSeq;
+  _cmdVal = val;
+  _cmdAttempt = 0;
+  _cmdStart = millis();
+  // Always at the same cadence, the remotes time their listening from it
+  sendCommand(RF_CMD_DST_ALL);
+#endif
+}
 
-  unsigned char outbuf[4];
-  const unsigned char nodeId = NODEID_MASTER;
-  const unsigned char _isRecent = 0;
+void RFManager::commandAck(const rf12_command_t *ack)
+{
+  unsigned char id = ((ack->byte0 & 0x0f) << 2) | (ack->byte1 >> 6);
+  unsigned int now = rf12_rxtime >> RF_TICK_SHIFT;
 
-  outbuf[0] = 0x90 | ((nodeId & 0x3f) >> 2);
-  outbuf[1] = ((nodeId & 0x3f) << 6) | _isRecent | (val >> 8);
-  outbuf[2] = (val & 0xff);
-  outbuf[3] = HYGRO_LMREMOTE_KEY | HYGRO_BATTERY_OK;
+  // Known, free, or the one heard from longest ago
+  unsigned char idx = 0;
+  for (unsigned char i=0; i<RF_REMOTE_COUNT; ++i)
+  {
+    if (_remotes[i].id == id)
+    {
+      idx = i;
+      break;
+    }
+    if (_remotes[idx].id != RFSOURCEID_NONE && (_remotes[i].id == RFSOURCEID_NONE ||
+      (unsigned int)(now - _remotes[i].lastAck) > (unsigned int)(now - _remotes[idx].lastAck)))
+      idx = i;
+  }
 
-  rf12_sendStart(outbuf, sizeof(outbuf));
-#endif
+  rf_remote_t &r = _remotes[idx];
+  if (r.id != id)
+  {
+    memset(&r, 0, sizeof(r));
+    r.id = id;
+    r.sent = 1;
+    r.ackSeq = ack->seq - 1;
+  }
+  r.lastAck = now;
+  r.rssi = ack->extra;
+
+  if (ack->seq == _cmdSeq && r.ackSeq != _cmdSeq)
+  {
+    r.ackSeq = _cmdSeq;
+    unsigned long latency = rf12_rxtime - _cmdStart;
+    r.latency = (latency > 0xff) ? 0xff : latency;
+    if (r.latency > r.worstLatency)
+      r.worstLatency = r.latency;
+  }
+}
+
+// Resends the command while a remote hasn't acked it, addressed to it if
+// it is the only one
+void RFManager::checkCommandRetry(void)
+{
+  if (_cmdAttempt >= RF_CMD_RETRIES ||
+    (unsigned int)((unsigned int)millis() - _cmdLastSend) < RF_CMD_RETRY_MS)
+    return;
+
+  unsigned char dst = RFSOURCEID_NONE;
+  for (unsigned char i=0; i<RF_REMOTE_COUNT; ++i)
+  {
+    rf_remote_t &r = _remotes[i];
+    if (r.id != RFSOURCEID_NONE && r.ackSeq != _cmdSeq)
+      dst = (dst == RFSOURCEID_NONE) ? r.id : RF_CMD_DST_ALL;
+  }
+  if (dst == RFSOURCEID_NONE)
+  {
+    _cmdAttempt = RF_CMD_RETRIES;
+    return;
+  }
+  // Not on top of a packet coming in
+  if (!rf12_canSend())
+    return;
+
+  for (unsigned char i=0; i<RF_REMOTE_COUNT; ++i)
+  {
+    rf_remote_t &r = _remotes[i];
+    if (r.id != RFSOURCEID_NONE && r.ackSeq != _cmdSeq)
+      ++r.retries;
+  }
+  ++_cmdAttempt;
+  sendCommand(dst);
+}
+
+void RFManager::remoteStatus(void)
+{
+  if (!_initialized)
+    return;
+
+  print_P(PSTR("HMRC"));
+  for (unsigned char i=0; i<RF_REMOTE_COUNT; ++i)
+  {
+    const rf_remote_t &r = _remotes[i];
+    if (r.id == RFSOURCEID_NONE)
+      continue;
+    Serial_csv();
+    SerialX.print(r.id, DEC);
+    Serial_csv();
+    SerialX.print(r.sent, DEC);
+    Serial_csv();
+    SerialX.print(r.failed, DEC);
+    Serial_csv();
+    SerialX.print(r.retries, DEC);
+    Serial_csv();
+    SerialX.print(r.latency, DEC);
+    Serial_csv();
+    SerialX.print(r.worstLatency, DEC);
+    Serial_csv();
+    SerialX.print(r.rssi, DEC);
+  }
+  Serial_nl();
+}
+
+void RFManager::itplusPacket(rf12_packet_t *pkt)
+{
+  unsigned char event = RFEVENT_Update;
+  unsigned char srcId = ((pkt->byte0 & 0x0f) << 2) | (pkt->byte1 >> 6);
+  unsigned char srcIdx = findSourceIdx(srcId);
+  if (srcIdx == 0xff)
+  {
+    srcIdx = allocSourceIdx(srcId);
+    event = RFEVENT_Add | RFEVENT_Update;
+  }
+  if (srcIdx != 0xff)
+  {
+    if (_sources[srcIdx].update(pkt))
+      if (_callback) _callback(_sources[srcIdx], event);
+  }
+}
+
+// Each probe in the packet is handled as if it had come in its own lmremote
+// IT+ packet, from base ID + probe
+void RFManager::multiPacket(const rf12_multi_t *multi)
+{
+  unsigned char baseId = ((multi->byte0 & 0x0f) << 2) | (multi->byte1 >> 6);
+  for (unsigned char probe=0; probe<RF_MULTI_VALUES; ++probe)
+  {
+    if ((multi->probes & bit(probe)) == 0)
+      continue;
+    const unsigned char *v = &multi->values[(probe / 2) * 3];
+    unsigned int val;
+    if (probe & 1)
+      val = ((v[1] & 0x0f) << 8) | v[2];
+    else
+      val = (v[0] << 4) | (v[1] >> 4);
+
+    unsigned char id = (baseId + probe) & 0x3f;
+    rf12_packet_t pkt;
+    pkt.byte0 = (RF_PKT_ITPLUS << 4) | (id >> 2);
+    pkt.byte1 = (id << 6) | (multi->byte1 & RF_MULTI_RECENT) | (val >> 8);
+    pkt.byte2 = val;
+    // lmremote key, and the battery bit
+    pkt.hygro = 0x7f | ((multi->byte1 & RF_MULTI_BATTERYLOW) ? 0x80 : 0);
+    itplusPacket(&pkt);
+  }
 }
 
 boolean RFManager::doWork(void)
@@ -153,9 +421,10 @@ boolean RFManager::doWork(void)
     return false;
 
   boolean retVal = false;
+  // Packets queue up in the interrupt while the loop is busy elsewhere
   while (rf12_recvDone())
   {
-    _lastReceive = millis();
+    _lastReceive = rf12_rxtime;
     /*
     Debug_begin(); print_P(PSTR("RF in "));
     SerialX.print(rf12_buf[0], HEX); SerialX.print(' ');
@@ -170,31 +439,30 @@ boolean RFManager::doWork(void)
         ++_crcOk;
         
       rf12_packet_t *pkt = (rf12_packet_t *)rf12_buf;
-
-      unsigned char event = RFEVENT_Update;
-      unsigned char srcId = ((pkt->byte0 & 0x0f) << 2) | (pkt->byte1 >> 6);
-      unsigned char srcIdx = findSourceIdx(srcId);
-      if (srcIdx == 0xff)
-      {
-        srcIdx = findFreeSourceIdx();
-        event = RFEVENT_Add | RFEVENT_Update;
-      }
-      if (srcIdx != 0xff)
-      {
-        _sources[srcIdx].setId(srcId);
-        if (_sources[srcIdx].update(pkt))
-          if (_callback) _callback(_sources[srcIdx], event);
-      }
+      unsigned char type = pkt->byte0 >> 4;
+      if (type == RF_PKT_ACK)
+        commandAck((rf12_command_t *)rf12_buf);
+      else if (type == RF_PKT_ITPLUS)
+        itplusPacket(pkt);
+      else if (type == RF_PKT_MULTI)
+        multiPacket((rf12_multi_t *)rf12_buf);
     }  /* if crc ok */
-    else if (_crcOk > 0)
+    else
     {
       //Debug_begin(); print_P(PSTR("RF ERR")); Debug_end();
-      --_crcOk;
+      if (_crcOk > 0)
+        --_crcOk;
+      // The id may be what was corrupted, but usually it is one we know
+      rf12_packet_t *pkt = (rf12_packet_t *)rf12_buf;
+      unsigned char srcIdx = findSourceIdx(((pkt->byte0 & 0x0f) << 2) | (pkt->byte1 >> 6));
+      if (srcIdx != 0xff)
+        _sources[srcIdx].crcError();
     }
       
     retVal = true;
   }  /* while recvDone() */
  
+  checkCommandRetry();
   freeStaleSources();
   return retVal;
 }
@@ -7,7 +7,14 @@
 #define RFSOURCEID_ANY    0x7f
 #define RFSOURCEID_NONE   0xff
 
-#define RF_SOURCE_COUNT   4
+// Sources tracked at once, up to 15. Ids mapped to a probe always get one,
+// the rest share what is left
+#ifndef RF_SOURCE_COUNT
+#define RF_SOURCE_COUNT   6
+#endif
+// Source ids are 6 bits
+#define RF_SOURCEID_COUNT 64
+#define RF_SLOT_NONE      0x0f
 // Actually transmit the fan speed every RF_SEND_INTERVAL sendUpdate() calls
 // Undefine or set to 0 to disable transmission
 #define RF_SEND_INTERVAL  5
@@ -15,10 +22,40 @@
 // The count of milliseconds with no receive that the source is considered stale
 // This should be large enough to allow the remote node to sleep
 #define RF_STALE_TIME (3 * 60 * 1000UL)
+// Receive times are kept in ticks of 1024ms
+#define RF_TICK_SHIFT 10
+#define RF_STALE_TICKS (RF_STALE_TIME >> RF_TICK_SHIFT)
+// Cadence the remotes send at, in ticks, for counting packets that never
+// arrived. IT+ sensors send about every 4 seconds, lmremote only sends on
+// a change but at least every 32.
+#define RF_ITPLUS_INTERVAL 4
+#define RF_LMREMOTE_MAXGAP 35
+// The average rssi is x64 and moves 1/8 of the way to each new reading
+#define RF_RSSIAVG_SHIFT   6
+#define RF_RSSIAVG_WEIGHT  3
 
 #define RFSOURCEFLAG_LowBattery   bit(0)
 #define RFSOURCEFLAG_RecentReset  bit(1)
 #define RFSOURCEFLAG_NativeItPlus bit(2)
+// The rssi is kept in the top bits of the flags
+#define RFSOURCE_RSSI_SHIFT 6
+#define RFSOURCE_FLAG_MASK  0x3f
+
+// The first nibble of a packet gives its length and what it is
+#define RF_PKT_ITPLUS  0x9
+#define RF_PKT_COMMAND 0xA  // to lmremote outputs
+#define RF_PKT_ACK     0xB  // from lmremote, a command arrived
+#define RF_PKT_MULTI   RF12_MULTI_TYPE  // lmremote, all its probes at once
+
+// A command to this id is for every lmremote
+#define RF_CMD_DST_ALL 0x3F
+// A command not acked by every remote is sent again after this long, this
+// many times. lmremote stays listening long enough to catch them, and staggers
+// its ack to a command for all by node id (RF_ACK_SLOTS there) within it.
+#define RF_CMD_RETRY_MS 25
+#define RF_CMD_RETRIES  3
+// lmremotes that have acked, tracked for delivery stats
+#define RF_REMOTE_COUNT 2
 
 typedef struct tagRf12Packet
 {
@@ -37,6 +74,59 @@ typedef struct tagRf12Packet
   unsigned char crc;
 } rf12_packet_t;
 
+typedef struct tagRf12Command
+{
+  // 4 bits RF_PKT_COMMAND or RF_PKT_ACK
+  // 6 bits of destination ID (command) or source ID (ack)
+  // 2 bits zero
+  // 12 bits output percent, where an IT+ packet has its data so older
+  //   lmremotes still take a command sent to RF_CMD_DST_ALL
+  // 8 bits sequence, one per command
+  // 8 bits attempt, 0 for the first send (command), or the rssi the
+  //   command was received at (ack)
+  // 8 bit CRC
+  unsigned char byte0;
+  unsigned char byte1;
+  unsigned char byte2;
+  unsigned char seq;
+  unsigned char extra;
+  unsigned char crc;
+} rf12_command_t;
+
+typedef struct tagRf12Multi
+{
+  // 4 bits RF_PKT_MULTI
+  // 6 bits of base ID, probe n is source base+n
+  // 1 bit Reset flag
+  // 1 bit low battery
+  // 4 bits zero
+  // 8 bits which probes have a value, bit n is probe n
+  // 6 x 12 bits raw analog read, probe 0 first, big endian like IT+
+  // 8 bit CRC
+  unsigned char byte0;
+  unsigned char byte1;
+  unsigned char probes;
+  unsigned char values[9];
+  unsigned char crc;
+} rf12_multi_t;
+#define RF_MULTI_VALUES     6
+#define RF_MULTI_RECENT     0x20
+#define RF_MULTI_BATTERYLOW 0x10
+
+typedef struct tagRfRemote
+{
+  unsigned char id;           // RFSOURCEID_NONE if unused
+  unsigned char ackSeq;       // of the last command it acked
+  unsigned char rssi;         // the last command was received at
+  unsigned char latency;      // ms from the first send to the ack, last
+  unsigned char worstLatency; // and worst
+  unsigned int lastAck;       // RF_TICK_SHIFT ticks
+  // 16-bit wrapping
+  unsigned int sent;
+  unsigned int failed;        // never acked
+  unsigned int retries;
+} rf_remote_t;
+
 class RFSource
 {
 public:
@@ -45,28 +135,46 @@ public:
   // The 6 bitID of the remote node (0-63)
   unsigned char getId(void) const { return _id; }
   void setId(unsigned char id);
-  unsigned char getFlags(void) const { return _flags; }
-  // millis() of the last receive
-  unsigned long getLastReceive(void) const { return _lastReceive; }
+  unsigned char getFlags(void) const { return _flags & RFSOURCE_FLAG_MASK; }
+  // millis() of the last receive, in RF_TICK_SHIFT ticks
+  unsigned int getLastReceive(void) const { return _lastReceive; }
   // Returns 0 (weakest) to 3 (strongest) signal
-  unsigned char getRssi(void) const { return _rssi; }
+  unsigned char getRssi(void) const { return _flags >> RFSOURCE_RSSI_SHIFT; }
 
   // true if last packet had the low battery flag
   boolean isBatteryLow(void) const { return _flags & RFSOURCEFLAG_LowBattery; }
   // true if last packet indicated IT+, that value = degrees C * 10
   boolean isNative(void) const { return _flags & RFSOURCEFLAG_NativeItPlus; }
   boolean isFree(void) const { return _id == RFSOURCEID_NONE; }
-  boolean isStale(void) const { return !isFree() && ((millis() - _lastReceive) > RF_STALE_TIME); }
+  boolean isStale(void) const { return !isFree() && getAge() > RF_STALE_TICKS; }
+  // Ticks since the last receive
+  unsigned int getAge(void) const { return (unsigned int)(millis() >> RF_TICK_SHIFT) - _lastReceive; }
 
   boolean update(rf12_packet_t *pkt);
+  // A packet with a bad CRC that claimed to be from this source
+  void crcError(void) { if (_crcErrors != 0xff) ++_crcErrors; }
+
+  // Link quality since the source was added
+  unsigned int getRxCount(void) const { return _rxCount; }
+  // Packets the cadence says were sent but never arrived
+  unsigned int getMissed(void) const { return _missed; }
+  unsigned char getCrcErrors(void) const { return _crcErrors; }
+  // Rssi average, x64 (RF_RSSIAVG_SHIFT)
+  unsigned char getRssiAvg(void) const { return _rssiAvg; }
+  // Longest time between two packets, ticks
+  unsigned char getMaxGap(void) const { return _maxGap; }
 
   int Value;
 
 private:
   unsigned char _id;
-  unsigned long _lastReceive;
-  unsigned char _flags;
-  unsigned char _rssi;
+  unsigned int _lastReceive;
+  unsigned char _flags;   // RFSOURCEFLAG_*, rssi in the top 2 bits
+  unsigned int _rxCount;
+  unsigned int _missed;
+  unsigned char _crcErrors;
+  unsigned char _rssiAvg;
+  unsigned char _maxGap;
 };
 
 #define RFEVENT_Add    bit(0)
@@ -79,13 +187,24 @@ public:
   typedef void (*event_callback)(RFSource& source, unsigned char event);
 
   RFManager(const event_callback fn) :
-    _callback(fn), _crcOk(0x80) {};
+    _callback(fn), _crcOk(0x80)
+  {
+    memset(_slotOfId, 0xff, sizeof(_slotOfId));
+    for (unsigned char i=0; i<RF_REMOTE_COUNT; ++i)
+      _remotes[i].id = RFSOURCEID_NONE;
+  };
   
   void init(unsigned char band);
   void freeStaleSources(void);
   unsigned char findFreeSourceIdx(void);
-  unsigned char findSourceIdx(unsigned char srcId);
+  unsigned char findSourceIdx(unsigned char srcId) const;
+  // Only these ids (RFSOURCEID_ANY entries are skipped) can push another
+  // source out of a full table
+  void setAllowed(const unsigned char *ids, unsigned char count);
+  boolean isAllowed(unsigned char srcId) const;
   void status(void);
+  // $HMRC, command delivery to each lmremote
+  void remoteStatus(void);
   boolean doWork(void);
   unsigned long getLastReceive(void) const { return _lastReceive; }
   static unsigned char getAdcBits(void) { return 12; }
@@ -94,12 +213,31 @@ public:
   RFSource *getSourceById(unsigned char srcId);
   
 private:
+  unsigned char allocSourceIdx(unsigned char srcId);
+  void freeSource(unsigned char idx);
+  void setSlotOfId(unsigned char srcId, unsigned char idx);
+  void sendCommand(unsigned char dst);
+  void commandAck(const rf12_command_t *ack);
+  void itplusPacket(rf12_packet_t *pkt);
+  void multiPacket(const rf12_multi_t *multi);
+  void checkCommandRetry(void);
+
   boolean _initialized;
   unsigned long _lastReceive;
   const event_callback _callback;
   unsigned char _crcOk;
   RFSource _sources[RF_SOURCE_COUNT];
   unsigned char _txCounter;
+  rf_remote_t _remotes[RF_REMOTE_COUNT];
+  unsigned char _cmdSeq;
+  unsigned char _cmdVal;
+  unsigned char _cmdAttempt;
+  unsigned long _cmdStart;      // millis() of the first send
+  unsigned int _cmdLastSend;    // and the latest
+  // Index into _sources of each id, a nibble each, RF_SLOT_NONE if none
+  unsigned char _slotOfId[RF_SOURCEID_COUNT / 2];
+  // Bit per id
+  unsigned char _allowed[RF_SOURCEID_COUNT / 8];
 };
 
 #endif /* __RFMANAGER_H__ */
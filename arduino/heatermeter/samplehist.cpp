@@ -0,0 +1,143 @@
+// HeaterMeter Copyright 2013 Bryan Mayland <bmayland@capnbry.net>
+#include "samplehist.h"
+
+static unsigned char countBits(unsigned char b)
+{
+  unsigned char n = 0;
+  for (; b; b >>= 1)
+    n += b & 1;
+  return n;
+}
+
+unsigned char SampleHistory::recordLen(unsigned char pos) const
+{
+  unsigned char hdr = _buf[pos & HISTORY_MASK];
+  unsigned char n = countBits(hdr & HISTORY_HDR_MASK);
+  return 1 + ((hdr & HISTORY_HDR_WIDE) ? n * 2 : (n + 1) / 2);
+}
+
+// Applies the record at pos to s, returns the position after it
+unsigned char SampleHistory::decode(unsigned char pos, history_sample_t &s) const
+{
+  unsigned char hdr = _buf[pos++ & HISTORY_MASK];
+  unsigned char nibble = 0;
+  for (unsigned char i=0; i<HISTORY_FIELDS; ++i)
+  {
+    if ((hdr & (1 << i)) == 0)
+      continue;
+    if (hdr & HISTORY_HDR_WIDE)
+    {
+      s.v[i] = _buf[pos & HISTORY_MASK] | (_buf[(pos + 1) & HISTORY_MASK] << 8);
+      pos += 2;
+    }
+    else
+    {
+      unsigned char b = _buf[pos & HISTORY_MASK];
+      if (nibble)
+      {
+        b >>= 4;
+        ++pos;
+      }
+      // Sign extend the nibble
+      s.v[i] += (int8_t)(b << 4) >> 4;
+      nibble = !nibble;
+    }
+  }
+  if (nibble)
+    ++pos;
+  return pos;
+}
+
+void SampleHistory::dropOldest(void)
+{
+  if (_count > 1)
+  {
+    unsigned char len = recordLen(_tail);
+    decode(_tail, _first);
+    _tail += len;
+    _used -= len;
+  }
+  --_count;
+}
+
+void SampleHistory::add(const history_sample_t &s)
+{
+  ++_seq;
+  if (_count == 0)
+  {
+    _first = _last = s;
+    _count = 1;
+    return;
+  }
+
+  unsigned char hdr = 0;
+  int16_t delta[HISTORY_FIELDS];
+  for (unsigned char i=0; i<HISTORY_FIELDS; ++i)
+  {
+    if (s.v[i] == _last.v[i])
+      continue;
+    hdr |= 1 << i;
+    // Going to or from no temperature isn't a small change either
+    delta[i] = s.v[i] - _last.v[i];
+    if (delta[i] < -8 || delta[i] > 7 || s.v[i] == HISTORY_NONE ||
+      _last.v[i] == HISTORY_NONE)
+      hdr |= HISTORY_HDR_WIDE;
+  }
+
+  unsigned char n = countBits(hdr & HISTORY_HDR_MASK);
+  unsigned char len = 1 + ((hdr & HISTORY_HDR_WIDE) ? n * 2 : (n + 1) / 2);
+  while (_used + len > HISTORY_SIZE || _count == 0xff)
+    dropOldest();
+
+  unsigned char pos = _tail + _used;
+  _used += len;
+  _buf[pos++ & HISTORY_MASK] = hdr;
+  unsigned char nibble = 0;
+  for (unsigned char i=0; i<HISTORY_FIELDS; ++i)
+  {
+    if ((hdr & (1 << i)) == 0)
+      continue;
+    if (hdr & HISTORY_HDR_WIDE)
+    {
+      _buf[pos++ & HISTORY_MASK] = s.v[i];
+      _buf[pos++ & HISTORY_MASK] = s.v[i] >> 8;
+    }
+    else if (nibble)
+      _buf[pos++ & HISTORY_MASK] |= delta[i] << 4;
+    else
+      _buf[pos & HISTORY_MASK] = delta[i] & 0x0f;
+    nibble = !nibble;
+  }
+
+  // A single sample can't fill the ring, so _first is still valid here
+  _last = s;
+  ++_count;
+}
+
+void SampleHistory::rewind(history_cursor_t &c) const
+{
+  c.seq = getOldestSeq();
+}
+
+boolean SampleHistory::next(history_cursor_t &c, history_sample_t &s) const
+{
+  unsigned int oldest = getOldestSeq();
+  if ((int)(c.seq - oldest) < 0)
+    c.seq = oldest;
+  if (_count == 0 || (unsigned int)(c.seq - oldest) >= _count)
+    return false;
+
+  if (c.seq == oldest)
+  {
+    s = _first;
+    c.pos = _tail;
+  }
+  else
+  {
+    s = c.val;
+    c.pos = decode(c.pos, s);
+  }
+  c.val = s;
+  ++c.seq;
+  return true;
+}
@@ -0,0 +1,72 @@
+// HeaterMeter Copyright 2013 Bryan Mayland <bmayland@capnbry.net>
+#ifndef __SAMPLEHIST_H__
+#define __SAMPLEHIST_H__
+
+#include <Arduino.h>
+
+// Bytes of encoded samples, a power of 2 no larger than 256. Ring positions
+// are unsigned char and run freely, they are masked on every access. A
+// steady cook is a nibble or two per field that moved, 128 bytes holds 30 or
+// more samples (10 minutes at hmcore's 20 second period). The worst case is
+// every field jumping every sample, HISTORY_WIDE_LEN bytes each, which leaves
+// 1 + 128 / 13 = 10 samples, a bit over 3 minutes. Builds with RAM to spare
+// can define a bigger ring.
+#ifndef HISTORY_SIZE
+#define HISTORY_SIZE   128
+#endif
+#define HISTORY_MASK   (HISTORY_SIZE - 1)
+typedef char history_size_ok[(HISTORY_SIZE <= 256 && (HISTORY_SIZE & HISTORY_MASK) == 0) ? 1 : -1];
+#define HISTORY_FIELDS 6   // setpoint, 4 probes, output
+#define HISTORY_NONE   ((int16_t)0x8000)  // no temperature
+
+// Each sample after the oldest is stored as a change from the one before it.
+// Header byte: bits 0-5 mark the fields that changed, bit 6 set means each
+// changed field follows as an int16 (LE), otherwise the changes are signed
+// nibbles (-8 to 7) packed low nibble first.
+#define HISTORY_HDR_WIDE 0x40
+#define HISTORY_HDR_MASK 0x3f
+// The longest record, every field changed and wide
+#define HISTORY_WIDE_LEN (1 + HISTORY_FIELDS * 2)
+
+typedef struct tagHistorySample
+{
+  int16_t v[HISTORY_FIELDS];
+} history_sample_t;
+
+typedef struct tagHistoryCursor
+{
+  unsigned int seq;       // sample next() returns
+  unsigned char pos;      // its record, unless it is the oldest
+  history_sample_t val;   // sample seq-1
+} history_cursor_t;
+
+class SampleHistory
+{
+public:
+  void add(const history_sample_t &s);
+
+  unsigned char getCount(void) const { return _count; }
+  // Sequence numbers count every sample ever added, 16-bit wrapping
+  unsigned int getNewestSeq(void) const { return _seq; }
+  unsigned int getOldestSeq(void) const { return _seq - _count + 1; }
+
+  // Oldest first. A cursor left behind by add() dropping samples skips
+  // ahead to the oldest remaining one.
+  void rewind(history_cursor_t &c) const;
+  boolean next(history_cursor_t &c, history_sample_t &s) const;
+
+private:
+  unsigned char recordLen(unsigned char pos) const;
+  unsigned char decode(unsigned char pos, history_sample_t &s) const;
+  void dropOldest(void);
+
+  unsigned char _buf[HISTORY_SIZE];
+  unsigned char _tail;    // record of the second oldest sample
+  unsigned int _used;     // bytes of _buf in use
+  unsigned char _count;   // samples held, including _first
+  unsigned int _seq;      // of the newest sample
+  history_sample_t _first;  // the oldest sample
+  history_sample_t _last;   // the newest sample
+};
+
+#endif /* __SAMPLEHIST_H__ */
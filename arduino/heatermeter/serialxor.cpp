@@ -1,4 +1,169 @@
 // HeaterMeter Copyright 2012 Bryan Mayland <bmayland@capnbry.net>
+#include <avr/pgmspace.h>
+#include <util/crc16.h>
 #include "serialxor.h"
 
 SerialXorChecksum SerialX;
+
+// 10^(2^i), used to find a decimal exponent in a handful of steps
+static const float POW10_POW2[] PROGMEM = { 1e1f, 1e2f, 1e4f, 1e8f, 1e16f, 1e32f };
+
+static unsigned long powerOf10(uint8_t n)
+{
+  unsigned long retVal = 1;
+  while (n--)
+    retVal *= 10;
+  return retVal;
+}
+
+void SerialXorChecksum::frameWrite(const void *p, uint8_t len)
+{
+  const uint8_t *src = (const uint8_t *)p;
+  while (len--)
+  {
+    if (_frameLen < SERIALX_FRAME_MAX)
+      _frame[_frameLen] = *src++;
+    // Keep counting past the end so endFrame() knows to drop it
+    if (_frameLen != 0xff)
+      ++_frameLen;
+  }
+}
+
+void SerialXorChecksum::endFrame(void)
+{
+  if (_frameLen > SERIALX_FRAME_MAX)
+    return;
+
+  uint16_t crc = 0xffff;
+  for (uint8_t i=0; i<_frameLen; ++i)
+    crc = _crc_ccitt_update(crc, _frame[i]);
+  _frame[_frameLen] = crc;
+  _frame[_frameLen + 1] = crc >> 8;
+  uint8_t len = _frameLen + 2;
+
+  // COBS: each run of non-zero bytes is sent after its length + 1, which
+  // stands in for the zero that ended it. Frames are too short to need
+  // the 254 byte run split.
+  txWrite(0);
+  uint8_t start = 0;
+  for (uint8_t i=0; i<=len; ++i)
+  {
+    if (i == len || _frame[i] == 0)
+    {
+      txWrite(i - start + 1);
+      while (start < i)
+        txWrite(_frame[start++]);
+      ++start;
+    }
+  }
+  txWrite(0);
+}
+
+uint8_t SerialXorChecksum::txBacklog(void)
+{
+  unsigned long now = micros();
+  unsigned long drained = (now - _txLast) >> SERIALX_BYTE_US_SHIFT;
+  if (drained >= _txBacklog)
+  {
+    _txBacklog = 0;
+    _txLast = now;
+  }
+  else
+  {
+    _txBacklog -= drained;
+    _txLast += drained << SERIALX_BYTE_US_SHIFT;
+  }
+  return _txBacklog;
+}
+
+void SerialXorChecksum::printDigits(unsigned long value, uint8_t minDigits)
+{
+  char buf[10];  // least significant first
+  uint8_t n = 0;
+  do
+  {
+    buf[n++] = '0' + value % 10;
+    value /= 10;
+  } while (value != 0 || n < minDigits);
+  while (n)
+    write(buf[--n]);
+}
+
+void SerialXorChecksum::printFixed(long value, uint8_t decimals)
+{
+  if (value < 0)
+  {
+    write('-');
+    value = -value;
+  }
+  unsigned long scale = powerOf10(decimals);
+  printDigits((unsigned long)value / scale, 1);
+  if (decimals)
+  {
+    write('.');
+    printDigits((unsigned long)value % scale, decimals);
+  }
+}
+
+void SerialXorChecksum::printDec(float f, uint8_t decimals)
+{
+  if (f < 0.0f)
+  {
+    write('-');
+    f = -f;
+  }
+  unsigned long scale = powerOf10(decimals);
+  unsigned long whole = f;
+  unsigned long frac = (f - whole) * scale + 0.5f;
+  if (frac >= scale)
+  {
+    ++whole;
+    frac -= scale;
+  }
+  printDigits(whole, 1);
+  if (decimals)
+  {
+    write('.');
+    printDigits(frac, decimals);
+  }
+}
+
+void SerialXorChecksum::printSci(float f, uint8_t digits)
+{
+  if (f < 0.0f)
+  {
+    write('-');
+    f = -f;
+  }
+  // Bring f into [1, 10), one multiply or divide per bit of the exponent
+  int8_t exponent = 0;
+  if (f != 0.0f)
+  {
+    for (int8_t i=sizeof(POW10_POW2)/sizeof(POW10_POW2[0])-1; i>=0; --i)
+    {
+      float p = pgm_read_float(&POW10_POW2[i]);
+      if (f >= p)
+      {
+        f /= p;
+        exponent += 1 << i;
+      }
+      else if (f < 1.0f && f * p < 10.0f)
+      {
+        f *= p;
+        exponent -= 1 << i;
+      }
+    }
+  }
+
+  unsigned long scale = powerOf10(digits);
+  unsigned long mantissa = f * scale + 0.5f;
+  // 9.9999 can round up to 10
+  if (mantissa >= scale * 10)
+  {
+    mantissa /= 10;
+    ++exponent;
+  }
+  printFixed(mantissa, digits);
+  write('e');
+  print((int)exponent, DEC);
+}
@@ -4,6 +4,40 @@
 
 #include "Arduino.h"
 
+// Binary frames are 0x00, COBS(Type, Record, CRC16 LSB first), 0x00 so they
+// can be told apart from the $ text lines, which never contain a 0x00.
+// The CRC is CRC-16/MCRF4XX (avr-libc _crc_ccitt_update, init 0xffff) over
+// the Type and Record. Records are fixed layout little-endian.
+#define SERIALX_FRAME_MAX 32
+
+// Record types, each replaces the text segment in its comment
+#define SERIALX_REC_STATUS 'S' // $HMSU
+#define SERIALX_REC_PIDINT 'P' // $HMPS
+
+// The core's interrupt driven TX buffer, writes block once it is full
+#define SERIALX_TX_BUFFER 64
+// 38400 baud is 260us per byte, 256 is close enough and just a shift
+#define SERIALX_BYTE_US_SHIFT 8
+
+// Temperature for a probe without one (text 'U')
+#define SERIALX_TEMP_NONE ((int32_t)0x80000000)
+
+struct __attribute__((__packed__)) serialx_rec_status
+{
+  int16_t setPoint;
+  int32_t temps[4];   // degrees x10, ohms or ADC in R and A units
+  uint8_t output;
+  uint8_t outputAvg;
+  uint16_t lidCountdown;
+  uint16_t sampleId;
+};
+
+struct __attribute__((__packed__)) serialx_rec_pidint
+{
+  float pid[4];       // B, P, I, D
+  float pitDelta;     // pit - pit average
+};
+
 class SerialXorChecksum : public Print
 {
 public:
@@ -14,29 +48,73 @@ public:
     {
       _preambleSent = true;
       _xsum = 0;
-      Serial.write('$');
+      txWrite('$');
     }
     _xsum ^= ch;
-    return Serial.write(ch);
+    return txWrite(ch);
   }
   
   void nl(void)
   {
-    Serial.write('*');
+    txWrite('*');
     hexwrite(_xsum / 16);
     hexwrite(_xsum % 16);
-    Serial.write('\n');
+    txWrite('\n');
     _preambleSent = false;
   }
+
+  // Binary mode sends SERIALX_REC_* frames instead of their text segments
+  boolean isBinary(void) const { return _binary; }
+  void setBinary(boolean value) { _binary = value; }
+  void beginFrame(uint8_t type) { _frameLen = 0; frameWrite(&type, 1); }
+  void frameWrite(const void *p, uint8_t len);
+  // Sends the frame, dropping it if more than SERIALX_FRAME_MAX was written
+  void endFrame(void);
+
+  // Estimated bytes still waiting in the core's TX buffer
+  uint8_t txBacklog(void);
+  // true if len more bytes can be written without waiting on the UART
+  boolean txRoom(uint8_t len) { return txBacklog() + len <= SERIALX_TX_BUFFER; }
+  // Number of bytes that had to wait for room in the TX buffer
+  unsigned int getTxOverflows(void) const { return _txOverflows; }
+
+  // Integer formatting in place of print(float), which spends a float
+  // multiply on every digit and pulls in the float print code.
+  // value in units of 10^-decimals, e.g. tenths of a degree
+  void printFixed(long value, uint8_t decimals);
+  // f to decimals places (at most 9), the whole part must fit in a long
+  void printDec(float f, uint8_t decimals);
+  // f as d.ddde-x with digits after the point (at most 8)
+  void printSci(float f, uint8_t digits);
   
 private:
   boolean _preambleSent;
   uint8_t _xsum;
+  boolean _binary;
+  uint8_t _frameLen;
+  uint8_t _frame[SERIALX_FRAME_MAX + 2];
+  uint8_t _txBacklog;
+  unsigned long _txLast;
+  unsigned int _txOverflows;
+
+  inline size_t txWrite(uint8_t ch)
+  {
+    if (_txBacklog == 0)
+      _txLast = micros();
+    else if (_txBacklog >= SERIALX_TX_BUFFER && txBacklog() >= SERIALX_TX_BUFFER)
+      ++_txOverflows;
+    if (_txBacklog < SERIALX_TX_BUFFER)
+      ++_txBacklog;
+    return Serial.write(ch);
+  }
+
+  // value with at least minDigits digits, zero padded
+  void printDigits(unsigned long value, uint8_t minDigits);
 
-  inline void hexwrite(uint8_t val) const 
+  inline void hexwrite(uint8_t val)
   {
     val = val < 10 ? val + '0' : val + 'A' - 10; 
-    Serial.write(val);
+    txWrite(val);
   };
 };
 
@@ -0,0 +1,98 @@
+// HeaterMeter Copyright 2013 Bryan Mayland <bmayland@capnbry.net>
+#include "tasksched.h"
+
+static unsigned int clampUs(unsigned long us)
+{
+  return (us > 0xffff) ? 0xffff : us;
+}
+
+TaskScheduler::TaskScheduler(const task_def_t *tasks, unsigned char count) :
+  _tasks(tasks), _count(min(count, TASK_MAX))
+{
+  // Insertion sort, stable so equal priorities keep their table order
+  for (unsigned char i=0; i<_count; ++i)
+  {
+    unsigned char prio = pgm_read_byte(&_tasks[i].priority);
+    unsigned char j = i;
+    while (j > 0 && pgm_read_byte(&_tasks[_order[j-1]].priority) > prio)
+    {
+      _order[j] = _order[j-1];
+      --j;
+    }
+    _order[j] = i;
+  }
+}
+
+void TaskScheduler::resetStats(void)
+{
+  for (unsigned char i=0; i<_count; ++i)
+  {
+    task_stats_t &s = _stats[i];
+    s.worst = 0;
+    s.total = 0;
+    s.runs = 0;
+    s.overruns = 0;
+  }
+  _loopWorst = 0;
+  _loopJitter = 0;
+  _loopTotal = 0;
+  _loopPasses = 0;
+}
+
+void TaskScheduler::doWork(void)
+{
+  unsigned long passStart = micros();
+  if (_passStart != 0)
+  {
+    unsigned int pass = clampUs(passStart - _passStart);
+    unsigned int jitter = (pass > _lastPass) ? pass - _lastPass : _lastPass - pass;
+    if (pass > _loopWorst)
+      _loopWorst = pass;
+    if (_loopPasses != 0 && jitter > _loopJitter)
+      _loopJitter = jitter;
+    _lastPass = pass;
+    // Stop averaging before the counter wraps, the worst still updates
+    if (_loopPasses != 0xffff)
+    {
+      _loopTotal += pass;
+      ++_loopPasses;
+    }
+  }
+  _passStart = passStart;
+
+  for (unsigned char o=0; o<_count; ++o)
+  {
+    unsigned char i = _order[o];
+    const task_def_t *t = &_tasks[i];
+    task_stats_t &s = _stats[i];
+    unsigned int period = pgm_read_word(&t->period);
+
+    unsigned int now = millis();
+    if (period != 0)
+    {
+      if ((unsigned int)(now - s.lastRun) < period)
+        continue;
+      if (!s.deferred && (micros() - passStart) > TASK_PASS_BUDGET_US)
+      {
+        s.deferred = true;
+        continue;
+      }
+    }
+    s.deferred = false;
+    s.lastRun = now;
+
+    unsigned long start = micros();
+    ((task_func_t)pgm_read_word(&t->func))();
+    unsigned int elapsed = clampUs(micros() - start);
+
+    if (elapsed > s.worst)
+      s.worst = elapsed;
+    if (elapsed > pgm_read_word(&t->deadline) && s.overruns != 0xff)
+      ++s.overruns;
+    if (s.runs != 0xffff)
+    {
+      s.total += elapsed;
+      ++s.runs;
+    }
+  }
+}
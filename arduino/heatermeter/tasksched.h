@@ -0,0 +1,62 @@
+// HeaterMeter Copyright 2013 Bryan Mayland <bmayland@capnbry.net>
+#ifndef __TASKSCHED_H__
+#define __TASKSCHED_H__
+
+#include <Arduino.h>
+
+#define TASK_MAX 8
+// Once a pass has run this long, due tasks with a period are held to the
+// next pass (at most one pass in a row) so the every-pass tasks stay prompt
+#define TASK_PASS_BUDGET_US 2000U
+
+typedef void (*task_func_t)(void);
+
+typedef struct tagTaskDef
+{
+  task_func_t func;
+  unsigned int period;      // ms between runs, 0 runs every pass
+  unsigned int deadline;    // us a single run should finish in
+  unsigned char priority;   // lower runs earlier in the pass
+} task_def_t;
+
+typedef struct tagTaskStats
+{
+  unsigned int lastRun;     // low 16 bits of millis()
+  unsigned int worst;       // us
+  unsigned long total;      // us, since the last reset
+  unsigned int runs;
+  unsigned char overruns;   // runs past the deadline
+  unsigned char deferred;   // held off last pass
+} task_stats_t;
+
+class TaskScheduler
+{
+public:
+  // tasks is a PROGMEM array of count task_def_t
+  TaskScheduler(const task_def_t *tasks, unsigned char count);
+
+  void doWork(void);
+  void resetStats(void);
+
+  unsigned char getTaskCount(void) const { return _count; }
+  const task_stats_t &getStats(unsigned char idx) const { return _stats[idx]; }
+  // Time between the start of successive passes, us
+  unsigned int getLoopWorst(void) const { return _loopWorst; }
+  unsigned int getLoopAvg(void) const { return _loopPasses ? _loopTotal / _loopPasses : 0; }
+  // Largest change in pass time from one pass to the next, us
+  unsigned int getLoopJitter(void) const { return _loopJitter; }
+
+private:
+  const task_def_t *_tasks;
+  unsigned char _count;
+  unsigned char _order[TASK_MAX];  // task indexes by priority
+  task_stats_t _stats[TASK_MAX];
+  unsigned long _passStart;
+  unsigned int _lastPass;
+  unsigned int _loopWorst;
+  unsigned int _loopJitter;
+  unsigned long _loopTotal;
+  unsigned int _loopPasses;
+};
+
+#endif /* __TASKSCHED_H__ */
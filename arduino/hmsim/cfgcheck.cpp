@@ -0,0 +1,268 @@
+// HeaterMeter Copyright 2013 Bryan Mayland <bmayland@capnbry.net>
+// Cuts the power after every possible EEPROM write of a ConfigStore commit
+// and checks that the config loaded after the reboot is always either the
+// old or the new one, never a mix or the defaults. The probe store's other
+// records have to come through untouched, and a staged name or config
+// transaction must not load before it is committed.
+#include <stdio.h>
+
+#include "Arduino.h"
+#include <avr/eeprom.h>
+#include "configstore.h"
+#include "grillpid.h"
+// hmcore.h enables the RFM12, which puts rfMap in the base config
+#define HEATERMETER_RFM12
+#include "hmeeprom.h"
+
+// Big enough for either struct, only the first size bytes are used
+#define CFG_MAX_SIZE sizeof(__eeprom_data)
+typedef char probe_fits[(sizeof(__eeprom_probe) <= CFG_MAX_SIZE) ? 1 : -1];
+
+typedef struct tagTestConfig
+{
+  unsigned char b[CFG_MAX_SIZE];
+} test_config_t;
+
+// Same layouts as hmcore.cpp
+typedef struct tagTestStore
+{
+  const char *name;
+  const unsigned char *copyA;
+  const unsigned char *copyB;
+  unsigned char size;
+  unsigned char count;
+} test_store_t;
+
+static const test_store_t STORES[] = {
+  { "base", (const unsigned char *)EEPROM_BASE_A_START,
+    (const unsigned char *)EEPROM_BASE_B_START, sizeof(__eeprom_data), 1 },
+  { "probe", (const unsigned char *)EEPROM_PROBE_A_START,
+    (const unsigned char *)EEPROM_PROBE_B_START, sizeof(__eeprom_probe), TEMP_COUNT },
+};
+
+// Each version changes a few fields of the one before, like a burst of
+// edits. Each record starts out different.
+static void makeConfig(unsigned char rec, unsigned char version, test_config_t &c)
+{
+  memset(&c, 0, sizeof(c));
+  for (unsigned char i=0; i<CFG_MAX_SIZE; ++i)
+    c.b[i] = 0x40 + i + rec * 0x10;
+  for (unsigned char v=1; v<=version; ++v)
+    for (unsigned char i=v % 5; i<CFG_MAX_SIZE; i+=5)
+      c.b[i] += v;
+}
+
+static boolean sameConfig(const test_store_t &t, const test_config_t &a, const test_config_t &b)
+{
+  return memcmp(&a, &b, t.size) == 0;
+}
+
+// Commits c to the record until done or the power is cut, true if done
+static boolean commitAll(ConfigStore &store, const test_config_t &c, unsigned char rec)
+{
+  while (store.commit(&c, rec))
+    if (simEepromWritesLeft == 0)
+      return false;
+  return true;
+}
+
+// Cuts the power in every possible place of the commit of rec from v1 to v2
+static int checkStore(const test_store_t &t, unsigned char rec)
+{
+  test_config_t v1, v2, v3, got;
+  makeConfig(rec, 1, v1);
+  makeConfig(rec, 2, v2);
+  makeConfig(rec, 3, v3);
+  int failed = 0;
+  long cut;
+  unsigned int oldCount = 0, newCount = 0;
+
+  for (cut=0; !failed; ++cut)
+  {
+    memset(simEeprom, 0xff, sizeof(simEeprom));
+    simEepromWritesLeft = -1;
+    boolean done;
+    {
+      // Every record is stored, then v1 is the newer copy of rec and
+      // version 0 the older, so v2 goes over the version 0 copy
+      ConfigStore store(t.copyA, t.copyB, t.size);
+      test_config_t v0;
+      for (unsigned char r=0; r<t.count; ++r)
+      {
+        makeConfig(r, 0, v0);
+        store.storeAll(&v0, r);
+      }
+      commitAll(store, v1, rec);
+
+      simEepromWritesLeft = cut;
+      done = commitAll(store, v2, rec);
+    }
+
+    // Reboot
+    simEepromWritesLeft = -1;
+    ConfigStore store(t.copyA, t.copyB, t.size);
+    for (unsigned char r=0; r<t.count && !failed; ++r)
+    {
+      if (r == rec)
+        continue;
+      test_config_t v0;
+      makeConfig(r, 0, v0);
+      if (!store.load(&got, r) || !sameConfig(t, got, v0))
+      {
+        printf("%s %u, cut after %ld writes: record %u changed\n", t.name, rec, cut, r);
+        failed = 1;
+      }
+    }
+    if (failed)
+      break;
+
+    if (!store.load(&got, rec))
+    {
+      printf("%s %u, cut after %ld writes: no valid copy\n", t.name, rec, cut);
+      failed = 1;
+    }
+    else if (sameConfig(t, got, v2))
+      ++newCount;
+    else if (sameConfig(t, got, v1) && !done)
+      ++oldCount;
+    else
+    {
+      printf("%s %u, cut after %ld writes: loaded a config that was never committed\n",
+        t.name, rec, cut);
+      failed = 1;
+    }
+
+    // The store carries on from whatever it loaded
+    ConfigStore reboot(t.copyA, t.copyB, t.size);
+    if (!failed && (!commitAll(store, v3, rec) || !reboot.load(&got, rec) ||
+      !sameConfig(t, got, v3)))
+    {
+      printf("%s %u, cut after %ld writes: the next commit didn't load back\n",
+        t.name, rec, cut);
+      failed = 1;
+    }
+
+    if (done)
+      break;
+  }
+
+  printf("%s %u: power cut at %ld points in the commit: old config loaded %u times, new %u\n",
+    t.name, rec, cut + 1, oldCount, newCount);
+  return failed;
+}
+
+// Stages a probe name the way storeProbeName() does, cutting the power at
+// every write of it. The old name has to load until the commit finishes.
+static int checkStagedName(const test_store_t &t, unsigned char rec)
+{
+  test_config_t v0, v1, got;
+  int failed = 0;
+  long cut;
+  unsigned char nameOfs = offsetof(__eeprom_probe, name);
+  static const char NAME[PROBE_NAME_SIZE] = "Brisket";
+
+  for (cut=0; !failed; ++cut)
+  {
+    memset(simEeprom, 0xff, sizeof(simEeprom));
+    simEepromWritesLeft = -1;
+    makeConfig(rec, 0, v0);
+    makeConfig(rec, 1, v1);
+    ConfigStore store(t.copyA, t.copyB, t.size);
+    store.storeAll(&v0, rec);
+    commitAll(store, v1, rec);
+
+    simEepromWritesLeft = cut;
+    store.stage(NAME, nameOfs, sizeof(NAME), rec);
+    boolean staged = simEepromWritesLeft != 0;
+    simEepromWritesLeft = -1;
+
+    ConfigStore reboot(t.copyA, t.copyB, t.size);
+    if (!reboot.load(&got, rec) || !sameConfig(t, got, v1))
+    {
+      printf("%s %u, cut after %ld writes: a staged name loaded\n", t.name, rec, cut);
+      failed = 1;
+    }
+    if (staged)
+      break;
+  }
+
+  // The commit takes the staged name from the older copy
+  test_config_t src;
+  memcpy(&src, &v1, sizeof(src));
+  simEepromWritesLeft = -1;
+  ConfigStore store(t.copyA, t.copyB, t.size);
+  store.load(&got, rec);
+  store.readStaged(src.b + nameOfs, nameOfs, sizeof(NAME), rec);
+  if (!failed && (memcmp(src.b + nameOfs, NAME, sizeof(NAME)) != 0 ||
+    !commitAll(store, src, rec) || !store.load(&got, rec) ||
+    memcmp(got.b + nameOfs, NAME, sizeof(NAME)) != 0))
+  {
+    printf("%s %u: the staged name didn't commit\n", t.name, rec);
+    failed = 1;
+  }
+  return failed;
+}
+
+// Stages a record the way a config transaction does: the older copy is
+// brought up to the running config v1, then v2 is staged over it. Nothing
+// loads before the commit, a discard commits v1 and a commit the staged v2.
+static int checkStagedTxn(const test_store_t &t, unsigned char rec)
+{
+  test_config_t v0, v1, v2, got;
+  makeConfig(rec, 0, v0);
+  makeConfig(rec, 1, v1);
+  makeConfig(rec, 2, v2);
+  int failed = 0;
+
+  for (unsigned char discard=0; discard<2 && !failed; ++discard)
+  {
+    memset(simEeprom, 0xff, sizeof(simEeprom));
+    simEepromWritesLeft = -1;
+    ConfigStore store(t.copyA, t.copyB, t.size);
+    store.storeAll(&v0, rec);
+    commitAll(store, v1, rec);
+
+    store.stage(&v1, 0, t.size, rec);
+    store.stage(&v2, 0, t.size, rec);
+    ConfigStore reboot(t.copyA, t.copyB, t.size);
+    if (!reboot.load(&got, rec) || !sameConfig(t, got, v1))
+    {
+      printf("%s %u: a staged transaction loaded\n", t.name, rec);
+      failed = 1;
+      break;
+    }
+
+    const test_config_t *want = &v1;
+    test_config_t staged;
+    if (!discard)
+    {
+      store.readStaged(&staged, 0, t.size, rec);
+      want = &staged;
+    }
+    if (!commitAll(store, *want, rec) || !reboot.load(&got, rec) ||
+      !sameConfig(t, got, discard ? v1 : v2))
+    {
+      printf("%s %u: the transaction didn't %s\n", t.name, rec,
+        discard ? "discard" : "commit");
+      failed = 1;
+    }
+  }
+  return failed;
+}
+
+int main(void)
+{
+  int failed = 0;
+  for (unsigned char s=0; s<sizeof(STORES)/sizeof(STORES[0]); ++s)
+    for (unsigned char rec=0; rec<STORES[s].count; ++rec)
+      failed |= checkStore(STORES[s], rec);
+  for (unsigned char rec=0; rec<TEMP_COUNT; ++rec)
+    failed |= checkStagedName(STORES[1], rec);
+  for (unsigned char s=0; s<sizeof(STORES)/sizeof(STORES[0]); ++s)
+    for (unsigned char rec=0; rec<STORES[s].count; ++rec)
+      failed |= checkStagedTxn(STORES[s], rec);
+
+  if (!failed)
+    printf("config OK\n");
+  return failed;
+}
@@ -0,0 +1,159 @@
+// HeaterMeter Copyright 2013 Bryan Mayland <bmayland@capnbry.net>
+// Checks the SerialX integer formatters against the float printing they
+// replaced: Print::print(double, n) and the old printSciFloat()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "simhw.h"
+#include "grillpid.h"
+#include "serialxor.h"
+
+// The sim hardware's ISRs drive it
+GrillPid pid(3, 8);
+
+static char out[64];
+static unsigned char outLen;
+
+static void captureSink(uint8_t ch)
+{
+  // SerialX starts each line with a '$'
+  if (ch != '$' && outLen < sizeof(out) - 1)
+    out[outLen++] = ch;
+  out[outLen] = '\0';
+}
+
+static void captureStart(void)
+{
+  outLen = 0;
+  out[0] = '\0';
+}
+
+// The old printSciFloat(), into out
+static void refSci(float f)
+{
+  char exponent = 0;
+  bool neg = f < 0.0f;
+  if (neg)
+    f *= -1.0f;
+  while (f < 1.0f && f != 0.0f)
+  {
+    --exponent;
+    f *= 10.0f;
+  }
+  while (f >= 10.0f)
+  {
+    ++exponent;
+    f /= 10.0f;
+  }
+  if (neg)
+    f *= -1.0f;
+  captureStart();
+  Serial.print(f, 7);
+  Serial.print('e');
+  Serial.print((int)exponent, DEC);
+}
+
+static int checkFixed(long value, unsigned char decimals, const char *expect)
+{
+  captureStart();
+  SerialX.printFixed(value, decimals);
+  SerialX.nl();
+  out[strcspn(out, "*")] = '\0';
+  if (strcmp(out, expect) == 0)
+    return 0;
+  printf("printFixed(%ld, %u) = %s, expected %s\n", value, decimals, out, expect);
+  return 1;
+}
+
+// Both round the same float, so only a value right on a half can differ,
+// and then by one in the last place. Past float precision both are noise.
+static int checkDec(float f, unsigned char decimals)
+{
+  char ref[sizeof(out)];
+  captureStart();
+  Serial.print(f, decimals);
+  strcpy(ref, out);
+
+  captureStart();
+  SerialX.printDec(f, decimals);
+  SerialX.nl();
+  out[strcspn(out, "*")] = '\0';
+  if (strcmp(out, ref) == 0)
+    return 0;
+  double ulp = fmax(pow(10, -decimals), fabs(atof(ref)) * 1e-6);
+  if (fabs(atof(out) - atof(ref)) <= 1.01 * ulp)
+    return 0;
+  printf("printDec(%g, %u) = %s, print() gives %s\n", f, decimals, out, ref);
+  return 1;
+}
+
+static int checkSci(float f)
+{
+  char ref[sizeof(out)];
+  refSci(f);
+  strcpy(ref, out);
+
+  captureStart();
+  SerialX.printSci(f, 7);
+  SerialX.nl();
+  out[strcspn(out, "*")] = '\0';
+  // The mantissa must be d.ddddddd, only 0 starting with a 0, and the
+  // value match to float precision
+  const char *m = (out[0] == '-') ? out + 1 : out;
+  double a = atof(out), b = atof(ref);
+  if ((m[0] != '0' || f == 0.0f) && m[1] == '.' && strchr(out, 'e') == m + 9 &&
+    fabs(a - b) <= fabs(b) * 1e-6)
+    return 0;
+  printf("printSci(%g) = %s, printSciFloat() gives %s\n", f, out, ref);
+  return 1;
+}
+
+int main(void)
+{
+  int failed = 0;
+  Serial.sink = captureSink;
+
+  failed += checkFixed(0, 1, "0.0");
+  failed += checkFixed(2254, 1, "225.4");
+  failed += checkFixed(-5, 1, "-0.5");
+  failed += checkFixed(-1234, 1, "-123.4");
+  failed += checkFixed(7, 3, "0.007");
+  failed += checkFixed(42, 0, "42");
+  failed += checkFixed(2147483647L, 2, "21474836.47");
+
+  // Temperatures and PID terms as status() and pidStatus() send them
+  unsigned long rnd = 1;
+  for (int i=0; i<20000; ++i)
+  {
+    rnd = rnd * 1103515245UL + 12345UL;
+    float f = ((long)(rnd >> 8) % 200000 - 100000) / 97.0f;
+    failed += checkDec(f, 1);
+    failed += checkDec(f, 2);
+    failed += checkDec(f / 1000.0f, 8);
+  }
+  failed += checkDec(0.0f, 2);
+  failed += checkDec(9.999f, 2);
+  failed += checkDec(-0.004f, 2);
+  failed += checkDec(28.5269f, 8);
+
+  // Probe coefficients and resistances
+  static const float SCI[] = { 0.0f, 1.0f, 9.9999999f, 10.0f, 2.4723753e-4f,
+    2.3402251e-4f, 1.3879768e-7f, 1.0e4f, 5.36924e-4f, 8.98053228e-4f,
+    -3.5e-5f, 22000.0f, 1.0e-20f, 3.0e20f };
+  for (unsigned int i=0; i<sizeof(SCI)/sizeof(SCI[0]); ++i)
+    failed += checkSci(SCI[i]);
+  for (int i=0; i<2000; ++i)
+  {
+    rnd = rnd * 1103515245UL + 12345UL;
+    float f = (float)(rnd >> 8) / (1UL << 24) * powf(10.0f, (int)(rnd % 24) - 12);
+    failed += checkSci(f);
+  }
+
+  if (failed)
+    printf("%d format mismatches\n", failed);
+  else
+    printf("format OK\n");
+  return failed != 0;
+}
@@ -0,0 +1,189 @@
+// HeaterMeter Copyright 2013 Bryan Mayland <bmayland@capnbry.net>
+// Checks that SampleHistory gives back exactly the samples added, for a
+// cook-like stream with small drifts, big jumps and unplugged probes, and
+// reports how many minutes the ring holds at the hmcore sample period. Then
+// the worst case, every field jumping every sample, has to hold exactly as
+// many samples as HISTORY_WIDE_LEN records fit. Build with -DHISTORY_SIZE
+// to check another ring size.
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "simhw.h"
+#include "samplehist.h"
+
+#define SAMPLE_COUNT 5000
+// Seconds between samples, same as HISTORY_PERIOD in hmcore.cpp
+#define SAMPLE_PERIOD 20
+// Coverage required, minutes
+#define MIN_MINUTES 10
+
+static SampleHistory history;
+static history_sample_t added[SAMPLE_COUNT];
+static unsigned long rnd = 1;
+
+static int randRange(int n)
+{
+  rnd = rnd * 1103515245UL + 12345UL;
+  return (rnd >> 16) % n;
+}
+
+static void makeSample(unsigned int i, history_sample_t &s)
+{
+  if (i == 0)
+  {
+    s.v[0] = 225;
+    s.v[1] = 70;
+    s.v[2] = 40;
+    s.v[3] = HISTORY_NONE;
+    s.v[4] = 70;
+    s.v[5] = 100;
+    return;
+  }
+  s = added[i - 1];
+  // Setpoint changes now and then
+  if (randRange(200) == 0)
+    s.v[0] = 150 + randRange(150);
+  // The pit wanders a couple degrees, food and ambient creep
+  s.v[1] += randRange(5) - 2;
+  for (unsigned char p=2; p<5; ++p)
+    if (s.v[p] != HISTORY_NONE && randRange(4) == 0)
+      s.v[p] += randRange(3) - 1;
+  // Probe 2 is plugged and unplugged
+  if (randRange(300) == 0)
+    s.v[3] = (s.v[3] == HISTORY_NONE) ? 65 : HISTORY_NONE;
+  // Lid open
+  if (randRange(100) == 0)
+    s.v[1] -= 40;
+  s.v[5] = randRange(3) ? s.v[5] : randRange(101);
+}
+
+static boolean sameSample(const history_sample_t &a, const history_sample_t &b)
+{
+  return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+// Walks the whole history and compares it to what was added
+static boolean checkAll(unsigned int addedCount)
+{
+  history_cursor_t c;
+  history_sample_t s;
+  unsigned int n = 0;
+  unsigned int first = addedCount - history.getCount();
+  history.rewind(c);
+  while (history.next(c, s))
+  {
+    if (!sameSample(s, added[first + n]))
+    {
+      printf("sample %u of %u differs after %u added\n", n, history.getCount(), addedCount);
+      return false;
+    }
+    ++n;
+  }
+  if (n != history.getCount() || history.getNewestSeq() != addedCount)
+  {
+    printf("walked %u of %u samples, newest seq %u\n", n, history.getCount(),
+      history.getNewestSeq());
+    return false;
+  }
+  return true;
+}
+
+// Every field jumps every sample, so every record is HISTORY_WIDE_LEN
+static void makeWideSample(unsigned int i, history_sample_t &s)
+{
+  for (unsigned char f=0; f<HISTORY_FIELDS; ++f)
+    s.v[f] = (i & 1) ? 300 + f : -100 - f;
+}
+
+static int checkWorstCase(void)
+{
+  static SampleHistory wide;
+  history_sample_t s, want;
+  for (unsigned int i=0; i<1000; ++i)
+  {
+    makeWideSample(i, s);
+    wide.add(s);
+  }
+
+  unsigned int expect = 1 + HISTORY_SIZE / HISTORY_WIDE_LEN;
+  unsigned int minutes = wide.getCount() * SAMPLE_PERIOD / 60;
+  printf("worst case holds %u samples, %u minutes\n", wide.getCount(), minutes);
+  if (wide.getCount() != expect)
+  {
+    printf("worst case should hold %u samples\n", expect);
+    return 1;
+  }
+
+  history_cursor_t c;
+  unsigned int n = 0;
+  wide.rewind(c);
+  while (wide.next(c, s))
+  {
+    // Sequence numbers start at 1
+    makeWideSample(wide.getOldestSeq() - 1 + n, want);
+    if (!sameSample(s, want))
+    {
+      printf("worst case sample %u differs\n", n);
+      return 1;
+    }
+    ++n;
+  }
+  return n != wide.getCount();
+}
+
+int main(void)
+{
+  unsigned int minCount = 0xffff;
+  history_cursor_t dump;
+  unsigned int dumpExpect = 0;
+  boolean dumping = false;
+  int failed = 0;
+
+  for (unsigned int i=0; i<SAMPLE_COUNT; ++i)
+  {
+    makeSample(i, added[i]);
+    history.add(added[i]);
+    if (!checkAll(i + 1))
+    {
+      failed = 1;
+      break;
+    }
+    // Only count once the ring has filled
+    if (i > 300 && history.getCount() < minCount)
+      minCount = history.getCount();
+
+    // A slow dump running alongside the adds, one sample per add
+    if (!dumping && randRange(50) == 0)
+    {
+      history.rewind(dump);
+      dumpExpect = i + 1 - history.getCount();
+      dumping = true;
+    }
+    if (dumping)
+    {
+      history_sample_t s;
+      // Samples dropped since the last step are skipped
+      unsigned int oldest = i + 1 - history.getCount();
+      if (dumpExpect < oldest)
+        dumpExpect = oldest;
+      if (!history.next(dump, s))
+        dumping = false;
+      else if (!sameSample(s, added[dumpExpect++]))
+      {
+        printf("dump differs at sample %u\n", dumpExpect - 1);
+        failed = 1;
+        break;
+      }
+    }
+  }
+
+  unsigned int minutes = minCount * SAMPLE_PERIOD / 60;
+  printf("history holds at least %u samples, %u minutes%s\n", minCount, minutes,
+    (minutes < MIN_MINUTES) ? " FAIL" : "");
+  if (minutes < MIN_MINUTES)
+    failed = 1;
+  failed |= checkWorstCase();
+  if (!failed)
+    printf("history OK\n");
+  return failed;
+}
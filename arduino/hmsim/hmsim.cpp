@@ -0,0 +1,414 @@
+// HeaterMeter Copyright 2013 Bryan Mayland <bmayland@capnbry.net>
+// Runs the unmodified GrillPid/TempProbe code against a simulated smoker and
+// reports how well the pit was held to the setpoint
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "simhw.h"
+#include "strings.h"
+#include "grillpid.h"
+#include "smoker.h"
+
+// Same wiring as hmcore.h
+#define PIN_PIT     5
+#define PIN_FOOD1   4
+#define PIN_AMB     2
+#define PIN_BLOWER  3
+#define PIN_SERVO   8
+
+static TempProbe probe0(PIN_PIT);
+static TempProbe probe1(PIN_FOOD1);
+static TempProbe probe2(PIN_AMB);
+static TempProbe probe3(PIN_AMB);
+GrillPid pid(PIN_BLOWER, PIN_SERVO);
+
+// Defaults from hmcore.cpp DEFAULT_CONFIG / DEFAULT_PROBE_CONFIG
+static const float DEFAULT_PID[4] = { 4.0f, 3.0f, 0.005f, 5.0f };
+static const float MAVERICK_ET73[STEINHART_COUNT] = {
+  2.4723753e-4, 2.3402251e-4, 1.3879768e-7, 1.0e+4
+};
+
+// Celsius to the ADC reading a thermistor with these coefficients would give
+static float tempToAdc(const float *stein, float tempC)
+{
+  // Invert 1/T = A + B ln(R) + C ln(R)^3 for ln(R)
+  float x = (stein[0] - 1.0f / (tempC + 273.15f)) / stein[2];
+  float y = sqrtf(powf(stein[1] / (3.0f * stein[2]), 3.0f) + x * x / 4.0f);
+  float r = expf(cbrtf(y - x / 2.0f) - cbrtf(y + x / 2.0f));
+  return 1023.0f * r / (r + stein[3]);
+}
+
+static ThermalModel *model;
+// ADC value of each pin in 1/256 LSB
+static long adcValue[8];
+static unsigned long noiseSeed = 1;
+// Chance in 65536 of a conversion being replaced by an impulse
+static unsigned int impulseOdds;
+
+// A couple LSB of noise, otherwise the oversampling has nothing to do
+static int noisyAdc(uint8_t pin)
+{
+  noiseSeed = noiseSeed * 1103515245UL + 12345UL;
+  // Motor noise on the probe leads, either slamming a rail or a spike
+  // somewhere in between
+  if (impulseOdds != 0)
+  {
+    unsigned int r = noiseSeed & 0xffff;
+    if (r < impulseOdds)
+      return (r & 1) ? 0 : (r & 2) ? 1023 : (r >> 2) & 0x3ff;
+  }
+  long noise = (long)((noiseSeed >> 16) & 0x3ff) * 3 / 4 - 384;
+  long adc = (adcValue[pin & 7] + noise + 128) >> 8;
+  return constrain(adc, 0, 1023);
+}
+
+static void serialEcho(uint8_t ch)
+{
+  putchar(ch);
+}
+
+struct Scenario
+{
+  const char *name;
+  int setPoint;          // F
+  float hours;
+  float lidOpenMins;     // When to open the lid, 0 for never
+  unsigned int lidSecs;  // How long it stays open
+  float ambient;         // C
+  float fuelHours;       // Hours the fuel lasts at the steady state burn, 0 = infinite
+  float impulsePct;      // Percent of ADC conversions hit by impulse noise
+  bool autotune;         // Autotune first and run with the results
+  // Regression limits, exceeding any fails the run
+  float maxOvershoot;    // F
+  float maxSettleMins;
+  float maxIae;          // F*min
+};
+
+struct Metrics
+{
+  float riseMins;       // First time the pit reached the setpoint
+  float overshoot;      // Largest excursion above the setpoint after rise
+  float settleMins;     // Time the pit entered the band for good, <0 never
+  float iae;            // Integral of absolute error over the run, F*min
+  float iaeSteady;      // Same, but only after rise
+  float lidRecoverMins; // Time back into the band after the lid closed, <0 never
+  float avgOutput;
+  unsigned int gaps;    // Periods the pit probe had no temperature
+};
+
+static const Scenario SCENARIOS[] = {
+  // name         sp   hrs  lid  secs amb   fuel imp   tune   ovs  settle iae
+  { "lowslow",    225, 12,  0,   0,   20,   0,   0,    false, 10,  55,    2200 },
+  { "hotfast",    350, 6,   0,   0,   20,   0,   0,    false, 10,  100,   7700 },
+  { "lid",        225, 6,   120, 60,  20,   0,   0,    false, 10,  55,    2900 },
+  { "coldday",    225, 12,  0,   0,   -5,   0,   0,    false, 10,  70,    3600 },
+  { "noisy",      225, 6,   0,   0,   20,   0,   0.05, false, 10,  55,    2200 },
+  { "tuned",      225, 12,  0,   0,   20,   0,   0,    true,  10,  40,    2000 },
+};
+#define SCENARIO_COUNT (sizeof(SCENARIOS)/sizeof(SCENARIOS[0]))
+
+static float toF(float c)
+{
+  return c * (9.0f / 5.0f) + 32.0f;
+}
+
+static void setupPid(const float *pidConst, int setPoint)
+{
+  struct __eeprom_probe cfg;
+  memset(&cfg, 0, sizeof(cfg));
+  memcpy(cfg.steinhart, MAVERICK_ET73, sizeof(cfg.steinhart));
+  cfg.probeType = PROBETYPE_INTERNAL;
+  probe0.loadConfig(&cfg);
+  probe1.loadConfig(&cfg);
+  probe2.loadConfig(&cfg);
+  cfg.probeType = PROBETYPE_DISABLED;
+  probe3.loadConfig(&cfg);
+  // loadConfig() leaves the readings from the last run, setProbeType() clears them
+  probe0.setProbeType(PROBETYPE_INTERNAL);
+  probe1.setProbeType(PROBETYPE_INTERNAL);
+  probe2.setProbeType(PROBETYPE_INTERNAL);
+  probe3.setProbeType(PROBETYPE_DISABLED);
+  pid.Probes[TEMP_PIT] = &probe0;
+  pid.Probes[TEMP_FOOD1] = &probe1;
+  pid.Probes[TEMP_FOOD2] = &probe3;
+  pid.Probes[TEMP_AMB] = &probe2;
+
+  pid.setUnits('F');
+  pid.LidOpenOffset = 6;
+  pid.setLidOpenDuration(240);
+  for (unsigned char i=PIDB; i<=PIDD; ++i)
+    pid.setPidConstant(i, pidConst[i]);
+  pid.setMinFanSpeed(10);
+  pid.setMaxFanSpeed(100);
+  pid.setMinServoPos(60);
+  pid.setMaxServoPos(250);
+  pid.setServoStepMax(20);
+  pid.setOutputFlags(0);
+  pid.setSetPoint(setPoint);
+  pid.init();
+}
+
+static SmokerParams scenarioParams(const Scenario &sc)
+{
+  SmokerParams params = SmokerModel::DEFAULT_PARAMS;
+  params.ambient = sc.ambient;
+  // Steady state burn at 225F is about 900W
+  params.fuelEnergy = sc.fuelHours * 3600.0f * 900.0f;
+  return params;
+}
+
+// Advance the model and ADC to the next doWork(), true if it finished a period
+static bool simStep(void)
+{
+  const float dt = (TEMP_MEASURE_PERIOD / TEMP_AVG_COUNT) / 1000.0f;
+  simMillis += TEMP_MEASURE_PERIOD / TEMP_AVG_COUNT;
+
+  float blower = simPinDuty[PIN_BLOWER] * (100.0f / 255.0f);
+  simServoRefresh(TEMP_MEASURE_PERIOD / TEMP_AVG_COUNT * 1000UL / SERVO_REFRESH);
+  float damper = ((pid.getServoPulse() / 20.0f) - pid.getMinServoPos()) * 100.0f /
+    (pid.getMaxServoPos() - pid.getMinServoPos());
+  model->step(dt, blower, damper);
+
+  adcValue[PIN_PIT] = tempToAdc(MAVERICK_ET73, model->getPitTemp()) * 256.0f;
+  adcValue[PIN_FOOD1] = tempToAdc(MAVERICK_ET73, model->getFoodTemp()) * 256.0f;
+  adcValue[PIN_AMB] = tempToAdc(MAVERICK_ET73, model->getAmbientTemp()) * 256.0f;
+  // The real ADC gets through every pin about 3 times per period, every
+  // other period is plenty here and keeps the run time down
+  if ((simMillis / (TEMP_MEASURE_PERIOD / TEMP_AVG_COUNT)) & 1)
+    simAdcConvert(NUM_ANALOG_INPUTS * ((1 << (2 * TEMP_OVERSAMPLE_BITS)) + 1));
+
+  return pid.doWork();
+}
+
+// Relay autotune at the scenario's setpoint, pidConst gets the results
+static bool runAutotune(const Scenario &sc, float *pidConst)
+{
+  SmokerModel smoker(scenarioParams(sc));
+  model = &smoker;
+  impulseOdds = sc.impulsePct * 655.36f;
+
+  simMillis = 0;
+  setupPid(pidConst, sc.setPoint);
+  pid.startAutotune();
+  while (pid.isAutotuneActive())
+    simStep();
+
+  if (pid.getAutotuneState() != AUTOTUNE_DONE)
+  {
+    printf("Autotune failed after %.1fh\n", simMillis / 3600000.0f);
+    return false;
+  }
+  for (unsigned char i=PIDP; i<=PIDD; ++i)
+    pidConst[i] = pid.getAutotunePid(i);
+  printf("Autotune %s in %.1fh P=%g I=%g D=%g\n", sc.name, simMillis / 3600000.0f,
+    pidConst[PIDP], pidConst[PIDI], pidConst[PIDD]);
+  return true;
+}
+
+static void runScenario(const Scenario &sc, const float *pidConst, float band,
+  unsigned int traceSecs, Metrics &m)
+{
+  SmokerModel smoker(scenarioParams(sc));
+  model = &smoker;
+  impulseOdds = sc.impulsePct * 655.36f;
+
+  simMillis = 0;
+  setupPid(pidConst, sc.setPoint);
+
+  const unsigned long endMillis = (unsigned long)(sc.hours * 3600000.0f);
+  const unsigned long lidOpenAt = (unsigned long)(sc.lidOpenMins * 60000.0f);
+  const unsigned long lidCloseAt = lidOpenAt + sc.lidSecs * 1000UL;
+
+  float overshoot = 0.0f, iae = 0.0f, iaeSteady = 0.0f, outputSum = 0.0f;
+  long riseAt = -1, lastOutside = 0, lidRecoverAt = -1;
+  unsigned long periods = 0;
+  m.gaps = 0;
+  while (simMillis < endMillis)
+  {
+    // The lid state applies to the step about to be taken
+    unsigned long next = simMillis + TEMP_MEASURE_PERIOD / TEMP_AVG_COUNT;
+    if (lidOpenAt != 0)
+      model->setLidOpen(next >= lidOpenAt && next < lidCloseAt);
+
+    if (!simStep())
+      continue;
+
+    // Once per TEMP_MEASURE_PERIOD, same as newTempsAvail()
+    const float periodMins = TEMP_MEASURE_PERIOD / 60000.0f;
+    const long now = simMillis / 1000;
+    float err = toF(model->getPitTemp()) - sc.setPoint;
+    ++periods;
+    outputSum += pid.getPidOutput();
+    if (!pid.Probes[TEMP_PIT]->hasTemperature())
+      ++m.gaps;
+    iae += fabsf(err) * periodMins;
+    if (riseAt < 0 && err >= 0.0f)
+      riseAt = now;
+    if (riseAt >= 0)
+    {
+      iaeSteady += fabsf(err) * periodMins;
+      if (err > overshoot)
+        overshoot = err;
+    }
+    // Settling is judged up until the lid is first opened
+    if (fabsf(err) > band && (lidOpenAt == 0 || simMillis < lidOpenAt))
+      lastOutside = now;
+    if (lidOpenAt != 0 && simMillis >= lidCloseAt)
+    {
+      if (fabsf(err) > band)
+        lidRecoverAt = -1;
+      else if (lidRecoverAt < 0)
+        lidRecoverAt = now;
+    }
+
+    if (Serial.sink)
+    {
+      print_P(PSTR("HMSU" CSV_DELIMITER));
+      pid.status();
+      Serial_nl();
+      pid.pidStatus();
+    }
+    if (traceSecs != 0 && (now % traceSecs) == 0)
+      printf("%ld,%.1f,%.1f,%.1f,%u,%.1f\n", now, toF(model->getPitTemp()),
+        pid.Probes[TEMP_PIT]->Temperature, toF(model->getFoodTemp()),
+        pid.getPidOutput(), model->getFuelLeft() * 100.0f);
+  }
+
+  const long endSecs = endMillis / 1000;
+  const long settleEnd = lidOpenAt ? (long)(lidOpenAt / 1000) : endSecs;
+  m.riseMins = riseAt / 60.0f;
+  m.overshoot = overshoot;
+  m.settleMins = (riseAt < 0 || lastOutside >= settleEnd - 1) ? -1.0f : (lastOutside + 1) / 60.0f;
+  m.iae = iae;
+  m.iaeSteady = iaeSteady;
+  m.lidRecoverMins = (lidOpenAt == 0 || lidRecoverAt < 0) ? -1.0f :
+    (lidRecoverAt - (long)(lidCloseAt / 1000)) / 60.0f;
+  m.avgOutput = periods ? outputSum / periods : 0.0f;
+}
+
+static bool checkMetrics(const Scenario &sc, const Metrics &m)
+{
+  if (m.riseMins < 0.0f || m.settleMins < 0.0f || m.gaps != 0)
+    return false;
+  if (sc.lidOpenMins != 0 && m.lidRecoverMins < 0.0f)
+    return false;
+  return m.overshoot <= sc.maxOvershoot && m.settleMins <= sc.maxSettleMins &&
+    m.iae <= sc.maxIae;
+}
+
+static void printHeader(void)
+{
+  printf("%-10s %5s %7s %8s %8s %9s %9s %7s %6s %5s\n", "scenario", "sp", "rise",
+    "overshoot", "settle", "iae", "iaeSteady", "lidrec", "out%", "gaps");
+}
+
+static void printMetrics(const char *name, int setPoint, const Metrics &m)
+{
+  printf("%-10s %5d %6.1fm %8.1fF %7.1fm %9.0f %9.0f %6.1fm %6.1f %5u\n", name,
+    setPoint, m.riseMins, m.overshoot, m.settleMins, m.iae, m.iaeSteady,
+    m.lidRecoverMins, m.avgOutput, m.gaps);
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr,
+    "Usage: %s [options]\n"
+    "  -r          Run the regression scenarios, exit non-zero if any fail\n"
+    "  -s SP       Setpoint (F) [225]\n"
+    "  -t HOURS    Length of the cook [12]\n"
+    "  -p B,P,I,D  PID constants [4,3,0.005,5]\n"
+    "  -l MIN,SEC  Open the lid at MIN minutes for SEC seconds\n"
+    "  -a C        Ambient temperature (C) [20]\n"
+    "  -f HOURS    Fuel load, in hours at 225F [infinite]\n"
+    "  -i PCT      Percent of ADC conversions hit by impulse noise [0]\n"
+    "  -b F        Settling band (+/- F) [5]\n"
+    "  -c SECS     Print a CSV trace every SECS seconds\n"
+    "  -u          Autotune at the setpoint first and run with the results\n"
+    "  -v          Echo the serial status output\n", name);
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  Scenario custom = { "custom", 225, 12, 0, 0, 20, 0, 0, false, 1e9, 1e9, 1e9 };
+  float pidConst[4];
+  memcpy(pidConst, DEFAULT_PID, sizeof(pidConst));
+  float band = 5.0f;
+  unsigned int traceSecs = 0;
+  bool regression = false;
+
+  for (int i=1; i<argc; ++i)
+  {
+    const char *arg = argv[i];
+    const char *val = (i + 1 < argc) ? argv[i + 1] : NULL;
+    if (arg[0] != '-' || arg[1] == '\0' || arg[2] != '\0')
+      usage(argv[0]);
+    switch (arg[1])
+    {
+      case 'r': regression = true; continue;
+      case 'u': custom.autotune = true; continue;
+      case 'v': Serial.sink = serialEcho; continue;
+    }
+    if (val == NULL)
+      usage(argv[0]);
+    ++i;
+    switch (arg[1])
+    {
+      case 's': custom.setPoint = atoi(val); break;
+      case 't': custom.hours = atof(val); break;
+      case 'a': custom.ambient = atof(val); break;
+      case 'f': custom.fuelHours = atof(val); break;
+      case 'i': custom.impulsePct = atof(val); break;
+      case 'b': band = atof(val); break;
+      case 'c': traceSecs = atoi(val); break;
+      case 'p':
+        if (sscanf(val, "%f,%f,%f,%f", &pidConst[0], &pidConst[1],
+          &pidConst[2], &pidConst[3]) != 4)
+          usage(argv[0]);
+        break;
+      case 'l':
+        if (sscanf(val, "%f,%u", &custom.lidOpenMins, &custom.lidSecs) != 2)
+          usage(argv[0]);
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+
+  simAnalogRead = noisyAdc;
+  printf("PID B=%g P=%g I=%g D=%g\n", pidConst[0], pidConst[1], pidConst[2], pidConst[3]);
+
+  Metrics m;
+  if (!regression)
+  {
+    if (custom.autotune && !runAutotune(custom, pidConst))
+      return 1;
+    runScenario(custom, pidConst, band, traceSecs, m);
+    printHeader();
+    printMetrics(custom.name, custom.setPoint, m);
+    return 0;
+  }
+
+  unsigned int failed = 0;
+  printHeader();
+  for (unsigned int i=0; i<SCENARIO_COUNT; ++i)
+  {
+    const Scenario &sc = SCENARIOS[i];
+    float scConst[4];
+    memcpy(scConst, pidConst, sizeof(scConst));
+    if (sc.autotune && !runAutotune(sc, scConst))
+    {
+      ++failed;
+      continue;
+    }
+    runScenario(sc, scConst, band, 0, m);
+    printMetrics(sc.name, sc.setPoint, m);
+    if (!checkMetrics(sc, m))
+    {
+      printf("  FAIL %s: limits overshoot<=%.0fF settle<=%.0fm iae<=%.0f gaps=0\n",
+        sc.name, sc.maxOvershoot, sc.maxSettleMins, sc.maxIae);
+      ++failed;
+    }
+  }
+  return failed ? 1 : 0;
+}
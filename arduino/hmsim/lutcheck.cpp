@@ -0,0 +1,126 @@
+// HeaterMeter Copyright 2013 Bryan Mayland <bmayland@capnbry.net>
+// Checks the TempProbe interpolation table against the Steinhart-Hart float
+// math for the built in probe coefficients, across every ADC reading. Probes
+// of the other types, or with coefficients that make no curve, must not take
+// a table slot from it.
+#include <stdio.h>
+
+#include "simhw.h"
+#include "grillpid.h"
+
+static TempProbe probe(0);
+static TempProbe rfProbe(1);
+static TempProbe offProbe(2);
+static TempProbe badProbe(3);
+GrillPid pid(3, 8);
+
+struct ProbeCoeff
+{
+  const char *name;
+  float steinhart[STEINHART_COUNT];
+};
+
+// Same sets as the web UI probe presets
+static const ProbeCoeff PROBES[] = {
+  { "Maverick ET-72/73", { 2.4723753e-4, 2.3402251e-4, 1.3879768e-7, 1.0e+4 } },
+  { "Maverick ET-732", { 5.36924e-4, 1.91396e-4, 6.60399e-8, 1.0e+4 } },
+  { "Radio Shack 10k", { 8.98053228e-4, 2.49263324e-4, 2.04047542e-7, 1.0e+4 } },
+  { "Vishay 10k NTCLE203E3103FB0", { 1.14061e-3, 2.32134e-4, 9.63666e-8, 1.0e+4 } },
+};
+
+// Largest error allowed inside the table, F
+#define MAX_ERROR 1.0
+
+static void loadProbe(TempProbe &p, unsigned char probeType, const float *stein)
+{
+  struct __eeprom_probe cfg;
+  memset(&cfg, 0, sizeof(cfg));
+  memcpy(cfg.steinhart, stein, sizeof(cfg.steinhart));
+  cfg.probeType = probeType;
+  p.loadConfig(&cfg);
+}
+
+static double referenceF(const float *stein, unsigned int adc)
+{
+  const double ADCmax = (1 << (10+TEMP_OVERSAMPLE_BITS)) - 1;
+  double r = log(stein[3] / (ADCmax / adc - 1.0));
+  double t = 1.0 / ((stein[2] * r * r + stein[1]) * r + stein[0]) - 273.15;
+  return t * 9.0 / 5.0 + 32.0;
+}
+
+int main(void)
+{
+  const unsigned int ADCmax = (1 << (10+TEMP_OVERSAMPLE_BITS)) - 1;
+  // Stay a degree inside the table ends, past them the float math is used
+  const double loF = (TEMP_LUT_MIN + 1) * 9.0 / 5.0 + 32.0;
+  const double hiF = (TEMP_LUT_MIN + (TEMP_LUT_COUNT - 1) * TEMP_LUT_STEP - 1) * 9.0 / 5.0 + 32.0;
+  int failed = 0;
+
+  pid.Probes[TEMP_PIT] = &probe;
+  pid.setUnits('F');
+
+  // Probes that aren't thermistors keep whatever coefficients they had. If
+  // they took tables, the TEMP_LUT_SLOTS would be gone before the loop below.
+  loadProbe(rfProbe, PROBETYPE_RF12, PROBES[1].steinhart);
+  loadProbe(offProbe, PROBETYPE_DISABLED, PROBES[2].steinhart);
+  if (rfProbe.hasLut() || offProbe.hasLut())
+  {
+    printf("a probe that isn't a thermistor took a table\n");
+    failed = 1;
+  }
+  // All zero is NaN all the way through Steinhart-Hart
+  static const float ZERO_STEIN[STEINHART_COUNT] = { 0, 0, 0, 0 };
+  loadProbe(badProbe, PROBETYPE_DISABLED, ZERO_STEIN);
+  badProbe.setProbeType(PROBETYPE_INTERNAL);
+  if (badProbe.hasLut())
+  {
+    printf("coefficients that make no curve built a table\n");
+    failed = 1;
+  }
+
+  printf("%-28s %8s %8s %8s\n", "probe", "maxerr", "at", "F");
+  for (unsigned int i=0; i<sizeof(PROBES)/sizeof(PROBES[0]); ++i)
+  {
+    loadProbe(probe, PROBETYPE_INTERNAL, PROBES[i].steinhart);
+    if (!probe.hasLut())
+    {
+      printf("%s got no table\n", PROBES[i].name);
+      failed = 1;
+    }
+
+    double maxErr = 0.0, maxErrF = 0.0;
+    unsigned int maxErrAdc = 0;
+    for (unsigned int adc=1; adc<ADCmax; ++adc)
+    {
+      double ref = referenceF(PROBES[i].steinhart, adc);
+      if (ref < loF || ref > hiF)
+        continue;
+      probe.addAdcValue(adc);
+      probe.calcTemp();
+      double err = fabs(probe.Temperature - ref);
+      // NaN fails too
+      if (!(err <= maxErr))
+      {
+        maxErr = isnan(err) ? INFINITY : err;
+        maxErrAdc = adc;
+        maxErrF = ref;
+      }
+    }
+
+    boolean ok = maxErr < MAX_ERROR;
+    printf("%-28s %8.2f %8u %8.1f%s\n", PROBES[i].name, maxErr, maxErrAdc, maxErrF,
+      ok ? "" : " FAIL");
+    if (!ok)
+      failed = 1;
+  }
+
+  // Switching a probe to a thermistor builds its table
+  rfProbe.setProbeType(PROBETYPE_INTERNAL);
+  if (!rfProbe.hasLut())
+  {
+    printf("setProbeType() built no table\n");
+    failed = 1;
+  }
+
+  return failed;
+}
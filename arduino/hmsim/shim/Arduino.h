@@ -0,0 +1,106 @@
+// HeaterMeter Copyright 2013 Bryan Mayland <bmayland@capnbry.net>
+// Minimal Arduino core stand-in used to build the GrillPid sources on the host
+#ifndef __SIM_ARDUINO_H__
+#define __SIM_ARDUINO_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+#include <avr/pgmspace.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 0x1
+#define LOW  0x0
+#define INPUT  0x0
+#define OUTPUT 0x1
+
+#define DEC 10
+#define HEX 16
+
+#define F_CPU 16000000L
+#define clockCyclesPerMicrosecond() (F_CPU / 1000000L)
+
+#define bit(b) (1UL << (b))
+#define bit_is_set(v, b) ((v) & bit(b))
+#define bit_is_clear(v, b) (!((v) & bit(b)))
+#define bitSet(v, b) ((v) |= bit(b))
+#define bitClear(v, b) ((v) &= ~bit(b))
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+#define min(a,b) ((a)<(b)?(a):(b))
+#define max(a,b) ((a)>(b)?(a):(b))
+
+// Interrupt vectors become plain functions the simulator can call
+#define ISR(vect) extern "C" void vect(void)
+#define cli()
+#define sei()
+
+// TIMER1, only the registers GrillPid touches
+extern volatile uint16_t TCNT1;
+extern volatile uint16_t OCR1B;
+extern volatile uint8_t TCCR1A;
+extern volatile uint8_t TCCR1B;
+extern volatile uint8_t TIMSK1;
+#define CS11   1
+#define OCIE1B 2
+
+// ADC
+extern volatile uint8_t ADMUX;
+extern volatile uint8_t ADCSRA;
+extern volatile uint8_t ADCSRB;
+extern volatile uint16_t ADC;
+#define ADSC  6
+#define ADATE 5
+#define ADIE  3
+#define NUM_ANALOG_INPUTS 6
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+// One output register per 8 pins, nothing reads them back
+extern volatile uint8_t simPorts[];
+#define digitalPinToPort(p) ((p) / 8)
+#define digitalPinToBitMask(p) (1 << ((p) % 8))
+#define portOutputRegister(port) (&simPorts[port])
+int analogRead(uint8_t pin);
+void analogWrite(uint8_t pin, int val);
+
+class Print
+{
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t) = 0;
+  size_t write(const char *str) { return write((const uint8_t *)str, strlen(str)); }
+  virtual size_t write(const uint8_t *buffer, size_t size);
+
+  size_t print(const char[]);
+  size_t print(char);
+  size_t print(unsigned char, int = DEC);
+  size_t print(int, int = DEC);
+  size_t print(unsigned int, int = DEC);
+  size_t print(long, int = DEC);
+  size_t print(unsigned long, int = DEC);
+  size_t print(double, int = 2);
+private:
+  size_t printNumber(unsigned long, uint8_t);
+  size_t printFloat(double, uint8_t);
+};
+
+class HardwareSerial : public Print
+{
+public:
+  using Print::write;
+  virtual size_t write(uint8_t ch);
+  // Everything written to the port is passed here, NULL discards it
+  void (*sink)(uint8_t ch);
+};
+
+extern HardwareSerial Serial;
+
+#endif /* __SIM_ARDUINO_H__ */
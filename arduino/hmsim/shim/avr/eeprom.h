@@ -0,0 +1,26 @@
+// HeaterMeter Copyright 2013 Bryan Mayland <bmayland@capnbry.net>
+// EEPROM in a RAM array, every write is finished before the call returns
+#ifndef __SIM_EEPROM_H__
+#define __SIM_EEPROM_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SIM_EEPROM_SIZE 1024
+
+extern uint8_t simEeprom[SIM_EEPROM_SIZE];
+// Byte writes left before the power is cut, later writes are lost. -1 for
+// no limit
+extern long simEepromWritesLeft;
+
+uint8_t eeprom_read_byte(const uint8_t *p);
+uint16_t eeprom_read_word(const uint16_t *p);
+void eeprom_read_block(void *dst, const void *src, size_t n);
+void eeprom_write_byte(uint8_t *p, uint8_t value);
+void eeprom_write_word(uint16_t *p, uint16_t value);
+void eeprom_write_block(const void *src, void *dst, size_t n);
+
+#define eeprom_is_ready() 1
+#define eeprom_busy_wait()
+
+#endif /* __SIM_EEPROM_H__ */
@@ -0,0 +1,23 @@
+// HeaterMeter Copyright 2013 Bryan Mayland <bmayland@capnbry.net>
+// Flash and RAM share one address space on the host
+#ifndef __SIM_PGMSPACE_H__
+#define __SIM_PGMSPACE_H__
+
+#include <string.h>
+#include <stdio.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+typedef char prog_char;
+
+#define pgm_read_byte(p) (*(const unsigned char *)(p))
+#define pgm_read_word(p) (*(const unsigned short *)(p))
+#define pgm_read_dword(p) (*(const unsigned long *)(p))
+#define pgm_read_float(p) (*(const float *)(p))
+#define memcpy_P memcpy
+#define strcpy_P strcpy
+#define strlen_P strlen
+#define strncmp_P strncmp
+#define snprintf_P snprintf
+
+#endif /* __SIM_PGMSPACE_H__ */
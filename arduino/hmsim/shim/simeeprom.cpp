@@ -0,0 +1,44 @@
+// HeaterMeter Copyright 2013 Bryan Mayland <bmayland@capnbry.net>
+#include <avr/eeprom.h>
+
+uint8_t simEeprom[SIM_EEPROM_SIZE];
+long simEepromWritesLeft = -1;
+
+uint8_t eeprom_read_byte(const uint8_t *p)
+{
+  return simEeprom[(size_t)p % SIM_EEPROM_SIZE];
+}
+
+uint16_t eeprom_read_word(const uint16_t *p)
+{
+  const uint8_t *b = (const uint8_t *)p;
+  return eeprom_read_byte(b) | (eeprom_read_byte(b + 1) << 8);
+}
+
+void eeprom_read_block(void *dst, const void *src, size_t n)
+{
+  for (size_t i=0; i<n; ++i)
+    ((uint8_t *)dst)[i] = eeprom_read_byte((const uint8_t *)src + i);
+}
+
+void eeprom_write_byte(uint8_t *p, uint8_t value)
+{
+  if (simEepromWritesLeft == 0)
+    return;
+  if (simEepromWritesLeft > 0)
+    --simEepromWritesLeft;
+  simEeprom[(size_t)p % SIM_EEPROM_SIZE] = value;
+}
+
+// Low byte first, same as avr-libc, so a cut can split the word
+void eeprom_write_word(uint16_t *p, uint16_t value)
+{
+  eeprom_write_byte((uint8_t *)p, value);
+  eeprom_write_byte((uint8_t *)p + 1, value >> 8);
+}
+
+void eeprom_write_block(const void *src, void *dst, size_t n)
+{
+  for (size_t i=0; i<n; ++i)
+    eeprom_write_byte((uint8_t *)dst + i, ((const uint8_t *)src)[i]);
+}
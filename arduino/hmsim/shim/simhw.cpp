@@ -0,0 +1,154 @@
+// HeaterMeter Copyright 2013 Bryan Mayland <bmayland@capnbry.net>
+#include "simhw.h"
+
+unsigned long simMillis;
+int (*simAnalogRead)(uint8_t pin);
+uint8_t simPinDuty[SIM_PIN_COUNT];
+
+volatile uint16_t TCNT1;
+volatile uint16_t OCR1B;
+volatile uint8_t TCCR1A;
+volatile uint8_t TCCR1B;
+volatile uint8_t TIMSK1;
+volatile uint8_t simPorts[4];
+volatile uint8_t ADMUX;
+volatile uint8_t ADCSRA;
+volatile uint8_t ADCSRB;
+volatile uint16_t ADC;
+
+extern "C" void ADC_vect(void);
+extern "C" void TIMER1_COMPB_vect(void);
+
+HardwareSerial Serial;
+
+unsigned long millis(void) { return simMillis; }
+unsigned long micros(void) { return simMillis * 1000UL; }
+void delay(unsigned long ms) { simMillis += ms; }
+void pinMode(uint8_t pin, uint8_t mode) { }
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+  if (pin < SIM_PIN_COUNT)
+    simPinDuty[pin] = val ? 255 : 0;
+}
+
+int digitalRead(uint8_t pin)
+{
+  return (pin < SIM_PIN_COUNT && simPinDuty[pin] != 0) ? HIGH : LOW;
+}
+
+int analogRead(uint8_t pin)
+{
+  return simAnalogRead ? simAnalogRead(pin) : 0;
+}
+
+void simAdcConvert(unsigned int count)
+{
+  if (bit_is_clear(ADCSRA, ADIE))
+    return;
+  while (count--)
+  {
+    ADC = analogRead(ADMUX & 0x07);
+    ADC_vect();
+  }
+}
+
+void simServoRefresh(unsigned int count)
+{
+  if (bit_is_clear(TIMSK1, OCIE1B))
+    return;
+  while (count--)
+  {
+    // Pulse start at the end of the refresh, then pulse end
+    TCNT1 = OCR1B = 0xffff;
+    TIMER1_COMPB_vect();
+    TCNT1 = OCR1B;
+    TIMER1_COMPB_vect();
+  }
+}
+
+void analogWrite(uint8_t pin, int val)
+{
+  if (pin < SIM_PIN_COUNT)
+    simPinDuty[pin] = constrain(val, 0, 255);
+}
+
+size_t HardwareSerial::write(uint8_t ch)
+{
+  if (sink)
+    sink(ch);
+  return 1;
+}
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+  size_t n = 0;
+  while (size--)
+    n += write(*buffer++);
+  return n;
+}
+
+size_t Print::print(const char str[]) { return write(str); }
+size_t Print::print(char c) { return write((uint8_t)c); }
+size_t Print::print(unsigned char b, int base) { return print((unsigned long)b, base); }
+size_t Print::print(int n, int base) { return print((long)n, base); }
+size_t Print::print(unsigned int n, int base) { return print((unsigned long)n, base); }
+size_t Print::print(unsigned long n, int base) { return printNumber(n, base); }
+size_t Print::print(double n, int digits) { return printFloat(n, digits); }
+
+size_t Print::print(long n, int base)
+{
+  if (base == 10 && n < 0)
+    return print('-') + printNumber(-n, 10);
+  return printNumber(n, base);
+}
+
+size_t Print::printNumber(unsigned long n, uint8_t base)
+{
+  char buf[8 * sizeof(long) + 1];
+  char *str = &buf[sizeof(buf) - 1];
+  *str = '\0';
+  do {
+    unsigned long m = n;
+    n /= base;
+    char c = m - base * n;
+    *--str = c < 10 ? c + '0' : c + 'A' - 10;
+  } while (n);
+  return write(str);
+}
+
+// Same rounding and truncation as the Arduino 1.0 core
+size_t Print::printFloat(double number, uint8_t digits)
+{
+  size_t n = 0;
+  if (isnan(number)) return print("nan");
+  if (isinf(number)) return print("inf");
+  if (number > 4294967040.0) return print("ovf");
+  if (number < -4294967040.0) return print("ovf");
+
+  if (number < 0.0)
+  {
+    n += print('-');
+    number = -number;
+  }
+
+  double rounding = 0.5;
+  for (uint8_t i=0; i<digits; ++i)
+    rounding /= 10.0;
+  number += rounding;
+
+  unsigned long int_part = (unsigned long)number;
+  double remainder = number - (double)int_part;
+  n += print(int_part);
+
+  if (digits > 0)
+    n += print('.');
+  while (digits-- > 0)
+  {
+    remainder *= 10.0;
+    int toPrint = int(remainder);
+    n += print(toPrint);
+    remainder -= toPrint;
+  }
+  return n;
+}
@@ -0,0 +1,23 @@
+// HeaterMeter Copyright 2013 Bryan Mayland <bmayland@capnbry.net>
+// Hooks the simulator uses to drive the fake Arduino core
+#ifndef __SIMHW_H__
+#define __SIMHW_H__
+
+#include "Arduino.h"
+
+#define SIM_PIN_COUNT 20
+
+// Current time returned by millis()/micros(), advanced by the simulator
+extern unsigned long simMillis;
+// Source of analogRead() values, must be set before anything reads the ADC
+extern int (*simAnalogRead)(uint8_t pin);
+// Last duty written to each pin (0-255), digitalWrite() sets 0 or 255
+extern uint8_t simPinDuty[SIM_PIN_COUNT];
+
+// Run count ADC conversions on the pin selected in ADMUX, if the ADC
+// interrupt is enabled
+void simAdcConvert(unsigned int count);
+// Run count servo refresh periods through the TIMER1 interrupt, if enabled
+void simServoRefresh(unsigned int count);
+
+#endif /* __SIMHW_H__ */
@@ -0,0 +1,9 @@
+// HeaterMeter Copyright 2013 Bryan Mayland <bmayland@capnbry.net>
+// Nothing interrupts the simulator
+#ifndef __SIM_ATOMIC_H__
+#define __SIM_ATOMIC_H__
+
+#define ATOMIC_BLOCK(type) for (int __done = 0; !__done; __done = 1)
+#define ATOMIC_RESTORESTATE
+
+#endif /* __SIM_ATOMIC_H__ */
@@ -0,0 +1,57 @@
+// HeaterMeter Copyright 2013 Bryan Mayland <bmayland@capnbry.net>
+#include "smoker.h"
+
+// Roughly a medium kamado: ~15 minutes to 225F at full blower, steady
+// state near 35% blower, 490F wide open
+const SmokerParams SmokerModel::DEFAULT_PARAMS = {
+  20.0f,     // ambient
+  20000.0f,  // pitCapacity
+  10.0f,     // pitLoss
+  200.0f,    // lidOpenLoss
+  0.06f,     // passiveAir
+  2200.0f,   // firePower
+  90.0f,     // fireTau
+  0.0f,      // fuelEnergy
+  8000.0f,   // foodCapacity
+  6.0f       // foodCoupling
+};
+
+SmokerModel::SmokerModel(const SmokerParams &params) :
+  _params(params), _lidOpen(false), _pitTemp(params.ambient),
+  _foodTemp(params.ambient), _firePower(0.0f), _fuelUsed(0.0f)
+{
+}
+
+float SmokerModel::getFuelLeft(void) const
+{
+  if (_params.fuelEnergy <= 0.0f)
+    return 1.0f;
+  float left = 1.0f - _fuelUsed / _params.fuelEnergy;
+  return left > 0.0f ? left : 0.0f;
+}
+
+void SmokerModel::step(float dt, float blowerPct, float damperPct)
+{
+  // The blower can only push as much air as the damper lets through,
+  // and the intake always leaks a little
+  float air = blowerPct / 100.0f;
+  if (air > damperPct / 100.0f)
+    air = damperPct / 100.0f;
+  if (air < _params.passiveAir)
+    air = _params.passiveAir;
+
+  // A fire running out of fuel fades over the last 10% of the load
+  float fuel = getFuelLeft() * 10.0f;
+  if (fuel > 1.0f)
+    fuel = 1.0f;
+
+  float target = _params.firePower * air * fuel;
+  _firePower += (target - _firePower) * (dt / _params.fireTau);
+  _fuelUsed += _firePower * dt;
+
+  float loss = _lidOpen ? _params.lidOpenLoss : _params.pitLoss;
+  float toFood = _params.foodCoupling * (_pitTemp - _foodTemp);
+  _pitTemp += (_firePower - loss * (_pitTemp - _params.ambient) - toFood)
+    * dt / _params.pitCapacity;
+  _foodTemp += toFood * dt / _params.foodCapacity;
+}
@@ -0,0 +1,61 @@
+// HeaterMeter Copyright 2013 Bryan Mayland <bmayland@capnbry.net>
+// Lumped-parameter thermal models the simulated probes are attached to
+#ifndef __SMOKER_H__
+#define __SMOKER_H__
+
+// Anything GrillPid can be run against. All temperatures are in Celsius.
+class ThermalModel
+{
+public:
+  virtual ~ThermalModel() {}
+  // Advance the model dt seconds with the blower and damper at the given percent
+  virtual void step(float dt, float blowerPct, float damperPct) = 0;
+  virtual void setLidOpen(bool open) = 0;
+  virtual float getPitTemp(void) const = 0;
+  virtual float getFoodTemp(void) const = 0;
+  virtual float getAmbientTemp(void) const = 0;
+  // Fraction of the fuel load left [0-1]
+  virtual float getFuelLeft(void) const = 0;
+};
+
+struct SmokerParams
+{
+  float ambient;       // C
+  float pitCapacity;   // J/C of the cooker body, grates and air
+  float pitLoss;       // W/C lost through the walls and vent with the lid closed
+  float lidOpenLoss;   // W/C lost with the lid open
+  float passiveAir;    // Fraction of full airflow drawn in with the blower off
+  float firePower;     // W released by the fire at full airflow
+  float fireTau;       // s the fire takes to respond to an airflow change
+  float fuelEnergy;    // J in the fuel load, 0 for a fire that never runs out
+  float foodCapacity;  // J/C of the meat
+  float foodCoupling;  // W/C from the pit into the meat
+};
+
+// Single chamber charcoal cooker with a blower and/or damper on the intake.
+// The fire settles toward a heat output proportional to the airflow, the pit
+// is one thermal mass losing heat to ambient, and the meat is a second mass
+// heated by the pit.
+class SmokerModel : public ThermalModel
+{
+public:
+  SmokerModel(const SmokerParams &params);
+  static const SmokerParams DEFAULT_PARAMS;
+
+  virtual void step(float dt, float blowerPct, float damperPct);
+  virtual void setLidOpen(bool open) { _lidOpen = open; }
+  virtual float getPitTemp(void) const { return _pitTemp; }
+  virtual float getFoodTemp(void) const { return _foodTemp; }
+  virtual float getAmbientTemp(void) const { return _params.ambient; }
+  virtual float getFuelLeft(void) const;
+
+private:
+  SmokerParams _params;
+  bool _lidOpen;
+  float _pitTemp;
+  float _foodTemp;
+  float _firePower;
+  float _fuelUsed;
+};
+
+#endif /* __SMOKER_H__ */
@@ -100,21 +100,37 @@ void ShiftRegLCDBase::init(uint8_t lines, uint8_t font)
 void ShiftRegLCDBase::clear()
 {
   command(LCD_CLEARDISPLAY);  // clear display, set cursor position to zero
-  delayMicroseconds(2000);    // this command takes a long time!
+  memset(_shadow, ' ', sizeof(_shadow));
+  _col = _row = _lcdAddr = 0;
 }
 
 void ShiftRegLCDBase::home()
 {
   command(LCD_RETURNHOME);  // set cursor position to zero
-  delayMicroseconds(2000);  // this command takes a long time!
+  _col = _row = _lcdAddr = 0;
 }
 
+// The move is only sent to the LCD when a write() needs it, unless the
+// cursor is visible
 void ShiftRegLCDBase::setCursor(uint8_t col, uint8_t row)
 {
-  const uint8_t row_offsets[] = { 0x00, 0x40, 0x14, 0x54 };
   if ( row > _numlines )
     row = _numlines-1;    // we count rows starting w/0
-  command(LCD_SETDDRAMADDR | (col + row_offsets[row]));
+  _col = col;
+  _row = row;
+  if (_displaycontrol & (LCD_CURSORON | LCD_BLINKON))
+    syncCursor();
+}
+
+void ShiftRegLCDBase::syncCursor(void)
+{
+  const uint8_t row_offsets[] = { 0x00, 0x40, 0x14, 0x54 };
+  uint8_t addr = _col + row_offsets[_row];
+  if (addr != _lcdAddr)
+  {
+    command(LCD_SETDDRAMADDR | addr);
+    _lcdAddr = addr;
+  }
 }
 
 // Turn the display on/off (quickly)
@@ -135,6 +151,7 @@ void ShiftRegLCDBase::noCursor() {
 void ShiftRegLCDBase::cursor() {
   _displaycontrol |= LCD_CURSORON;
   command(LCD_DISPLAYCONTROL | _displaycontrol);
+  syncCursor();
 }
 
 // Turn on and off the blinking cursor
@@ -145,6 +162,7 @@ void ShiftRegLCDBase::noBlink() {
 void ShiftRegLCDBase::blink() {
   _displaycontrol |= LCD_BLINKON;
   command(LCD_DISPLAYCONTROL | _displaycontrol);
+  syncCursor();
 }
 
 // These commands scroll the display without changing the RAM
@@ -183,14 +201,16 @@ void ShiftRegLCDBase::shiftDecrement(void) {
 void ShiftRegLCDBase::createChar(uint8_t location, uint8_t charmap[]) {
   location &= 0x7; // we only have 8 locations 0-7
   command(LCD_SETCGRAMADDR | location << 3);
-  write(charmap, 8);
+  for (uint8_t i=0; i<8; ++i)
+    send(charmap[i], HIGH);
   command(LCD_SETDDRAMADDR); // Reset display to display text (from pos. 0)
 }
 
 void ShiftRegLCDBase::createChar_P(uint8_t location, const prog_char *p) {
   location &= 0x7; // we only have 8 locations 0-7
   command(LCD_SETCGRAMADDR | location << 3);
-  write_P(p, 8);
+  for (uint8_t i=0; i<8; ++i)
+    send(pgm_read_byte(p++), HIGH);
   command(LCD_SETDDRAMADDR); // Reset display to display text (from pos. 0)
 }
 
@@ -218,10 +238,28 @@ void ShiftRegLCDBase::write_P(const prog_char *p, uint8_t len)
 
 void ShiftRegLCDBase::command(uint8_t value) {
   send(value, LOW);
+  // Any command may have moved the cursor
+  _lcdAddr = 0xff;
 }
 
+// Only characters that differ from the shadow are sent, and the cursor is
+// only moved when the LCD's isn't already there. Skipping is off while the
+// cursor is visible or the entry mode isn't the default left to right.
 size_t ShiftRegLCDBase::write(uint8_t value) {
-  send(value, HIGH);
+  uint8_t *cell = (_row < SHIFTREGLCD_ROWS && _col < SHIFTREGLCD_COLS) ?
+    &_shadow[_row][_col] : NULL;
+  boolean plain = _displaymode == (LCD_ENTRYLEFT | LCD_ENTRYSHIFTDECREMENT) &&
+    !(_displaycontrol & (LCD_CURSORON | LCD_BLINKON));
+
+  if (cell == NULL || *cell != value || !plain)
+  {
+    syncCursor();
+    send(value, HIGH);
+    if (cell != NULL)
+      *cell = value;
+    _lcdAddr = plain ? _lcdAddr + 1 : 0xff;
+  }
+  ++_col;
   return sizeof(value);
 }
 
@@ -241,7 +279,7 @@ void ShiftRegLCDNative::ctor(uint8_t srdata, uint8_t srclock, uint8_t enable, ui
   init(lines, font);
 };
 
-void ShiftRegLCDNative::send(uint8_t value, uint8_t mode) const
+void ShiftRegLCDNative::send(uint8_t value, uint8_t mode)
 {
   uint8_t val1, val2;
   if ( _two_wire ) shiftOut ( _srdata_pin, _srclock_pin, MSBFIRST, 0x00 ); // clear shiftregister
@@ -260,9 +298,11 @@ void ShiftRegLCDNative::send(uint8_t value, uint8_t mode) const
   delayMicroseconds(1);                 // enable pulse must be >450ns
   ::digitalWrite( _enable_pin, LOW );
   delayMicroseconds(40);               // commands need > 37us to settle
+  if (mode == 0 && value <= LCD_RETURNHOME)
+    delayMicroseconds(2000);           // clear and home take a long time!
 }
 
-void ShiftRegLCDNative::send4bits(uint8_t value) const
+void ShiftRegLCDNative::send4bits(uint8_t value)
 {
   uint8_t val1;
   ::digitalWrite( _enable_pin, LOW );
@@ -275,7 +315,7 @@ void ShiftRegLCDNative::send4bits(uint8_t value) const
   delayMicroseconds(40);               // commands need > 37us to settle
 }
 
-void ShiftRegLCDNative::updateAuxPins(void) const
+void ShiftRegLCDNative::updateAuxPins(void)
 {
   if ( _two_wire ) shiftOut ( _srdata_pin, _srclock_pin, MSBFIRST, 0x00 ); // clear shiftregister
   shiftOut( _srdata_pin, _srclock_pin, MSBFIRST, _auxPins);
@@ -305,6 +345,10 @@ ShiftRegLCDSPI::ShiftRegLCDSPI(uint8_t srlatch, uint8_t lines)
   _srlatch_pinmask = digitalPinToBitMask(srlatch);
   _srlatch_portreg = portOutputRegister(digitalPinToPort(srlatch));
   pinMode(srlatch, OUTPUT);
+  _ss_pinmask = digitalPinToBitMask(SS);
+  _ss_portreg = portOutputRegister(digitalPinToPort(SS));
+  _qhead = _qtail = _qwait = 0;
+  active = this;
 
   // The enable line may have been left high by something so we need to clear it
   spi_byte(0);
@@ -347,27 +391,113 @@ void ShiftRegLCDSPI::spi_lcd(uint8_t value) const
   spi_byte(value);
 }
 
-void ShiftRegLCDSPI::send(uint8_t value, uint8_t mode) const
+// Queue entry flags
+#define SRLCD_Q_DATA    0x01  // RS high, a character
+#define SRLCD_Q_NIBBLE  0x02  // only the high nibble, used during init
+#define SRLCD_Q_AUX     0x04  // just update the aux pins
+#define SRLCD_Q_SLOW    0x08  // clear or home, wait 2ms after
+
+// TIMER0 runs in fast PWM at clk/64 for millis(), so OCR0A is double
+// buffered and only takes a new value at BOTTOM: COMPA fires once per
+// 1.024ms wrap no matter what is written to it. Each wrap sends one entry,
+// the wrap itself covers the HD44780's > 37us settle so nothing waits with
+// interrupts off. A long command (clear/home, 1.52ms) waits out another
+// full wrap.
+#define SRLCD_SLOW_WRAPS    1
+
+ShiftRegLCDSPI *ShiftRegLCDSPI::active;
+
+ISR(TIMER0_COMPA_vect)
 {
-  uint8_t val;
-  mode = mode ? SPI_LCD_RS : 0; // RS bit; LOW: command.  HIGH: character.
-  mode |= _auxPins;
+  ShiftRegLCDSPI::active->pump();
+}
 
-  val = mode | (value & 0xf0); // upper nibble
-  spi_lcd(val);
-  val = mode | (value << 4);   // lower nibble
-  spi_lcd(val);
+void ShiftRegLCDSPI::sendNow(uint8_t value, uint8_t flags) const
+{
+  if (flags & SRLCD_Q_AUX)
+    spi_byte(_auxPins);
+  else if (flags & SRLCD_Q_NIBBLE)
+    spi_lcd(value & 0xf0);
+  else
+  {
+    uint8_t mode = (flags & SRLCD_Q_DATA) ? SPI_LCD_RS : 0; // RS bit; LOW: command.  HIGH: character.
+    mode |= _auxPins;
+    spi_lcd(mode | (value & 0xf0)); // upper nibble
+    spi_lcd(mode | (value << 4));   // lower nibble
+  }
+}
 
-  delayMicroseconds(40);               // commands need > 37us to settle
+void ShiftRegLCDSPI::pump(void)
+{
+  if (_qwait != 0)
+  {
+    --_qwait;
+    return;
+  }
+  // Another device (the RFM12) is mid-transfer, try again next wrap
+  if ((*_ss_portreg & _ss_pinmask) == 0)
+    return;
+
+  if (_qhead == _qtail)
+  {
+    TIMSK0 &= ~_BV(OCIE0A);
+    return;
+  }
+
+  uint8_t tail = _qtail;
+  uint8_t flags = _qflags[tail];
+  sendNow(_qvalue[tail], flags);
+  _qtail = (tail + 1) & (SHIFTREGLCD_QUEUE_SIZE - 1);
+
+  if (flags & SRLCD_Q_SLOW)
+    _qwait = SRLCD_SLOW_WRAPS;
 }
 
-void ShiftRegLCDSPI::send4bits(uint8_t value) const
+void ShiftRegLCDSPI::enqueue(uint8_t value, uint8_t flags)
 {
-  spi_lcd(value & 0xf0);
-  delayMicroseconds(40);               // commands need > 37us to settle
+  // Static construction runs before interrupts are on, send those directly
+  if ((SREG & _BV(SREG_I)) == 0)
+  {
+    sendNow(value, flags);
+    delayMicroseconds((flags & SRLCD_Q_SLOW) ? 2000 : 40);
+    return;
+  }
+
+  uint8_t head = _qhead;
+  uint8_t next = (head + 1) & (SHIFTREGLCD_QUEUE_SIZE - 1);
+  // Only waits if the queue is full
+  while (next == _qtail)
+    ;
+  _qvalue[head] = value;
+  _qflags[head] = flags;
+  _qhead = next;
+
+  // Start the pump if it has gone idle
+  uint8_t sreg = SREG;
+  cli();
+  if ((TIMSK0 & _BV(OCIE0A)) == 0)
+  {
+    // Fires once per wrap, the next one is at most 1.024ms away
+    TIFR0 = _BV(OCF0A);
+    TIMSK0 |= _BV(OCIE0A);
+  }
+  SREG = sreg;
+}
+
+void ShiftRegLCDSPI::send(uint8_t value, uint8_t mode)
+{
+  uint8_t flags = mode ? SRLCD_Q_DATA : 0;
+  if (mode == LOW && value <= LCD_RETURNHOME)
+    flags |= SRLCD_Q_SLOW;
+  enqueue(value, flags);
+}
+
+void ShiftRegLCDSPI::send4bits(uint8_t value)
+{
+  enqueue(value, SRLCD_Q_NIBBLE);
 }
 
-void ShiftRegLCDSPI::updateAuxPins(void) const
+void ShiftRegLCDSPI::updateAuxPins(void)
 {
-  spi_byte(_auxPins);
+  enqueue(0, SRLCD_Q_AUX);
 }
@@ -47,6 +47,17 @@
 #define SR_RS_BIT 0x04
 #define SR_EN_BIT 0x80
 
+// ShiftRegLCDSPI queues everything it sends and paces it out to the HD44780
+// from the TIMER0 COMPA interrupt, one entry per 1.024ms timer wrap, so
+// pin 6 (OC0A) is not available for PWM
+#define SHIFTREGLCD_QUEUE_SIZE 16  // entries, must be a power of 2
+
+// Size of the shadow of the display contents, writes outside it always go
+// to the LCD. init() only knows 1 or 2 lines, rows 2 and 3 of a 4 line
+// display are only reached through setCursor() and aren't worth the RAM.
+#define SHIFTREGLCD_COLS 16
+#define SHIFTREGLCD_ROWS 2
+
 class ShiftRegLCDBase : public Print {
 public:
   void clear();
@@ -79,17 +90,25 @@ public:
   void digitalWrite(uint8_t pin, uint8_t val);
 protected:
   void init(uint8_t lines, uint8_t font);
-  virtual void send(uint8_t, uint8_t) const = 0;
-  virtual void send4bits(uint8_t) const = 0;
-  virtual void updateAuxPins(void) const = 0;
+  // Clear and home must be followed by a 2ms wait, send() handles it
+  virtual void send(uint8_t, uint8_t) = 0;
+  virtual void send4bits(uint8_t) = 0;
+  virtual void updateAuxPins(void) = 0;
   ShiftRegLCDBase(void) {};
 
   uint8_t _auxPins;
 private:
+  void syncCursor(void);
+
   uint8_t _displayfunction;
   uint8_t _displaycontrol;
   uint8_t _displaymode;
   uint8_t _numlines;
+  // What the LCD is showing, a write() of the same character is skipped
+  uint8_t _shadow[SHIFTREGLCD_ROWS][SHIFTREGLCD_COLS];
+  uint8_t _col;      // where the next write() goes
+  uint8_t _row;
+  uint8_t _lcdAddr;  // DDRAM address of the LCD's own cursor, 0xff if unknown
 };
 
 class ShiftRegLCDNative : public ShiftRegLCDBase
@@ -105,9 +124,9 @@ public:
   ShiftRegLCDNative(uint8_t srdata, uint8_t srclockd, uint8_t enable, uint8_t lines, uint8_t font)
     { ctor(srdata, srclockd, enable, lines, font); };
 protected:
-  virtual void send(uint8_t, uint8_t) const;
-  virtual void send4bits(uint8_t) const;
-  virtual void updateAuxPins(void) const;
+  virtual void send(uint8_t, uint8_t);
+  virtual void send4bits(uint8_t);
+  virtual void updateAuxPins(void);
 private:
   void ctor(uint8_t srdata, uint8_t srclockd, uint8_t enable, uint8_t lines, uint8_t font);
   uint8_t _srdata_pin;
@@ -133,16 +152,31 @@ class ShiftRegLCDSPI : public ShiftRegLCDBase
 {
 public:
   ShiftRegLCDSPI(uint8_t srlatch, uint8_t lines);
+  // Sends the next queued entry, called from the TIMER0 COMPA interrupt
+  // once per timer wrap
+  void pump(void);
+  static ShiftRegLCDSPI *active;
 protected:
-  virtual void send(uint8_t, uint8_t) const;
-  virtual void send4bits(uint8_t) const;
-  virtual void updateAuxPins(void) const;
+  virtual void send(uint8_t, uint8_t);
+  virtual void send4bits(uint8_t);
+  virtual void updateAuxPins(void);
 private:
+  void enqueue(uint8_t value, uint8_t flags);
+  void sendNow(uint8_t value, uint8_t flags) const;
   void spi_byte(uint8_t out) const;
   void spi_lcd(uint8_t value) const;
 
   uint8_t _srlatch_pinmask;
   volatile uint8_t *_srlatch_portreg;
+  // The SPI bus is shared, nothing is sent while another device has SS low
+  uint8_t _ss_pinmask;
+  volatile uint8_t *_ss_portreg;
+  // Volatile so an entry is stored before _qhead publishes it
+  volatile uint8_t _qvalue[SHIFTREGLCD_QUEUE_SIZE];
+  volatile uint8_t _qflags[SHIFTREGLCD_QUEUE_SIZE];  // SRLCD_Q_*
+  volatile uint8_t _qhead;   // next entry to fill
+  volatile uint8_t _qtail;   // next entry to send
+  uint8_t _qwait;            // timer wraps left of a long command's wait
 };
 
 #ifdef SHIFTREGLCD_NATIVE
@@ -118,14 +118,32 @@ enum {
     TXSYN1, TXSYN2,
 };
 
-static volatile uint8_t rxfill;     // number of data bytes in rf12_buf
+// a packet as the interrupt finished receiving it
+typedef struct tagRxPacket {
+    uint8_t data[RF_MAX];
+    uint8_t len;
+    uint8_t crc;        // zero if it checked out
+    uint8_t drssi;      // DRSSI state when it ended
+    uint16_t time;      // low 16 bits of millis() when it ended
+} rxpacket_t;
+
+static volatile uint8_t rxfill;     // number of data bytes received
 static volatile int8_t rxstate;     // current transceiver state
+static volatile uint8_t rxlen;      // length of the packet being received
+static volatile uint8_t rxcrc;      // running crc of the packet being received
+static volatile uint8_t rxdrop;     // no room in the queue for it
+// the interrupt fills rxqueue[rxhead], rf12_recvDone() empties rxtail
+static volatile rxpacket_t rxqueue[RF12_RXQUEUE];
+static volatile uint8_t rxhead, rxtail;
 
 volatile uint8_t rf12_crc;         // running crc value
 volatile uint8_t rf12_buf[RF_MAX];  // recv/xmit buf, including hdr & crc bytes
 volatile uint8_t rf12_len;
+uint32_t rf12_rxtime;
+volatile uint16_t rf12_rxoverflow;
 static uint8_t rf12_status;
 static uint8_t drssi;
+static uint8_t rxdrssi;             // drssi of the packet in rf12_buf
 
 itplus_initial_t itplus_initial_cb;
 
@@ -257,6 +275,15 @@ static void rf12_setDrssi(uint8_t d)
     rf12_xfer(0x94A0 | drssi);
 }
 
+// receive the next packet, call with interrupts disabled
+static void rf12_recvOn () {
+    rxfill = 0;
+    rxcrc = 0;
+    rxlen = 0xff;
+    rf12_setDrssi(3);
+    rf12_xfer(RF_RECEIVER_ON);
+}
+
 static void rf12_interrupt() {
     // a transfer of 2x 16 bits @ 2 MHz over SPI takes 2x 8 us inside this ISR
     // correction: now takes 2 + 8 µs, since sending can be done at 8 MHz
@@ -280,18 +307,36 @@ static void rf12_interrupt() {
             // The first 4 bits should be the length of 
             // the data that follows in quartets (4 bitses)
             // Round up to the nearest byte
-            rf12_len = ((in >> 4) + 2) * 4 / 8;
-            if (rf12_len < 2 || rf12_len > RF_MAX)
-                rf12_len = 2;
+            rxlen = ((in >> 4) + 2) * 4 / 8;
+            if ((in >> 4) == RF12_MULTI_TYPE)
+                rxlen = RF12_MULTI_LEN;
+            if (rxlen < 2 || rxlen > RF_MAX)
+                rxlen = 2;
+            rxdrop = (uint8_t)(rxhead - rxtail) >= RF12_RXQUEUE;
             if (itplus_initial_cb)
                 itplus_initial_cb();
         }
 
-        rf12_buf[rxfill++] = in;
-        rf12_crc = itplus_crc_update(rf12_crc, in);
+        volatile rxpacket_t *pkt = &rxqueue[rxhead % RF12_RXQUEUE];
+        if (!rxdrop)
+            pkt->data[rxfill] = in;
+        ++rxfill;
+        rxcrc = itplus_crc_update(rxcrc, in);
 
-        if (rxfill == rf12_len)
+        if (rxfill == rxlen) {
             rf12_xfer(RF_IDLE_MODE);
+            if (rxdrop)
+                ++rf12_rxoverflow;
+            else {
+                pkt->len = rxlen;
+                pkt->crc = rxcrc;
+                pkt->drssi = drssi;
+                pkt->time = millis();
+                ++rxhead;
+            }
+            // listen again now, the main loop may not get to it for a while
+            rf12_recvOn();
+        }
     } else {
         uint8_t out;
 
@@ -332,25 +377,34 @@ static void rf12_interrupt() {
 #endif
 
 static void rf12_recvStart () {
-    rxfill = 0;
-    rf12_crc = 0;
-    rf12_len = 0xff;
-    rxstate = TXRECV;
     ATOMIC_BLOCK(ATOMIC_FORCEON)
     {
-      rf12_setDrssi(3);
-      rf12_xfer(RF_RECEIVER_ON);
+      rxstate = TXRECV;
+      rf12_recvOn();
     }
 }
 
 uint8_t rf12_recvDone () {
-    if (rxstate == TXRECV && rf12_len == rxfill) {
-        rxstate = TXIDLE;
-        return 1;
-    }
+    // rf12_buf is also the transmit buffer, leave it alone while sending
+    if (rxstate != TXRECV && rxstate != TXIDLE)
+        return 0;
     if (rxstate == TXIDLE)
         rf12_recvStart();
-    return 0;
+    if (rxhead == rxtail)
+        return 0;
+
+    // the interrupt doesn't touch this slot until rxtail moves past it
+    volatile rxpacket_t *pkt = &rxqueue[rxtail % RF12_RXQUEUE];
+    rf12_len = pkt->len;
+    for (uint8_t i = 0; i < rf12_len; ++i)
+        rf12_buf[i] = pkt->data[i];
+    rf12_crc = pkt->crc;
+    rxdrssi = pkt->drssi;
+    // the packet can't have waited 65s, so its age fits in 16 bits
+    uint32_t now = millis();
+    rf12_rxtime = now - (uint16_t)((uint16_t)now - pkt->time);
+    ++rxtail;
+    return 1;
 }
 
 uint8_t rf12_canSend () {
@@ -483,5 +537,5 @@ char rf12_lowbat () {
 
 char rf12_rssi () {
     //const int8_t table[] = {-109, -103, -97, -91, -85, -79, -73};
-    return drssi / 2;
+    return rxdrssi / 2;
 }
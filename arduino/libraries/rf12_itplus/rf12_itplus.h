@@ -6,7 +6,12 @@
 
 #include <stdint.h>
 
-#define RF12_MAXDATA    10
+#define RF12_MAXDATA    13
+// lmremote multi-reading packets, their length isn't in the first nibble
+#define RF12_MULTI_TYPE 0xC
+#define RF12_MULTI_LEN  13
+// completed packets the interrupt can hold until rf12_recvDone(), power of 2
+#define RF12_RXQUEUE    2
 
 #define RF12_433MHZ     1
 #define RF12_868MHZ     2
@@ -20,6 +25,8 @@ extern volatile uint8_t rf12_crc;  // running crc value, should be zero at end
 extern volatile uint8_t rf12_buf[]; // recv/xmit buf including hdr & crc bytes
 extern volatile uint8_t rf12_len;
 extern volatile uint16_t rf_bad_status;
+extern uint32_t rf12_rxtime;  // millis() when the packet in rf12_buf ended
+extern volatile uint16_t rf12_rxoverflow; // packets dropped, queue full
 
 // only needed if you want to init the SPI bus before rf12_initialize does it
 void rf12_spiInit(void);
@@ -32,7 +39,8 @@ void rf12_initialize(uint8_t band);
 // returns the node ID as 1..31 value (1..26 correspond to nodes 'A'..'Z')
 uint8_t rf12_config(uint8_t show =1);
 
-// call this frequently, returns true if a packet has been received
+// call this frequently, returns true if a packet has been received and
+// moved from the queue to rf12_buf, rf12_len, rf12_crc and rf12_rxtime
 uint8_t rf12_recvDone(void);
 
 // call this to check whether a new transmission can be started
@@ -53,7 +61,8 @@ void rf12_sleep(char n);
 // returns nonzero if the supply voltage is below 3.1V
 char rf12_lowbat(void);
 
-// returns signal level 0 (weakest) to 3 (strongest)
+// returns signal level 0 (weakest) to 3 (strongest) of the last packet
+// from rf12_recvDone()
 char rf12_rssi(void);
 
 // low-level control of the RFM12B via direct register access
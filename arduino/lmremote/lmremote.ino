@@ -54,6 +54,21 @@ const unsigned char _pinOutputServo = 8;   // ATmega pin 14
 #define HYGRO_NO_HYGRO     0x6A
 #define HYGRO_SECOND_PROBE 0x7D
 #define HYGRO_LMREMOTE_KEY 0x7F
+// First nibble of the packet
+#define RF_PKT_COMMAND     0xA
+#define RF_PKT_ACK         0xB
+#define RF_PKT_MULTI       RF12_MULTI_TYPE
+// byte1 of a multi-reading packet
+#define MULTI_RECENT_BOOT  0x20
+#define MULTI_BATTERY_LOW  0x10
+// Unacked commands are resent this often, this many times
+#define RF_CMD_RETRY_MS    25
+#define RF_CMD_RETRIES     3
+// Acks to a command sent to all remotes go out in a slot picked by the low
+// bits of the node id, so two remotes don't answer on top of each other.
+// The last slot plus the ack's airtime has to finish inside RF_CMD_RETRY_MS
+#define RF_ACK_SLOTS       4
+#define RF_ACK_SLOT_MS     5
 
 #define RECV_CYCLE_TIME  5000    // expected receive cycle, millisecond
 #define MIN_RECV_WIN     8       // minimum window size (ms), power of 2
@@ -95,6 +110,8 @@ static unsigned int _recvWindow;
 static unsigned long _recvLast;
 static unsigned char _recvLost;
 static unsigned char _recvState;
+// Resends of the command last received, so it can be timed from the first
+static unsigned char _recvAttempt;
 
 extern "C" GrillPid pid(_pinOutputFan, _pinOutputServo);
 
@@ -113,6 +130,21 @@ static void setOutputPercent(unsigned char val)
     pid.setPidOutput(val);
 }
 
+static void transmitAck(unsigned char seq, unsigned int val)
+{
+  unsigned char outbuf[5];
+  unsigned char nodeId = _rfNodeBaseId;
+  outbuf[0] = (RF_PKT_ACK << 4) | ((nodeId & 0x3f) >> 2);
+  outbuf[1] = ((nodeId & 0x3f) << 6) | (val >> 8);
+  outbuf[2] = (val & 0xff);
+  outbuf[3] = seq;
+  outbuf[4] = rf12_rssi();
+
+  // The receiver is still up, the transmitter comes up fast from there
+  rf12_sendStart(outbuf, sizeof(outbuf));
+  rf12_sendWait(SLEEPMODE_TX);
+}
+
 static bool packetReceived(unsigned char nodeId, unsigned int val)
 {
 #if LMREMOTE_SERIAL
@@ -125,6 +157,21 @@ static bool packetReceived(unsigned char nodeId, unsigned int val)
   Serial.print('\n');
 #endif
 
+  _recvAttempt = 0;
+  if ((rf12_buf[0] >> 4) == RF_PKT_COMMAND)
+  {
+    // nodeId is who it is for
+    if (nodeId != NODEID_MASTER && nodeId != _rfNodeBaseId)
+      return false;
+    _recvAttempt = rf12_buf[4];
+    setOutputPercent(val);
+    if (nodeId == NODEID_MASTER)
+      delay((_rfNodeBaseId % RF_ACK_SLOTS) * RF_ACK_SLOT_MS);
+    transmitAck(rf12_buf[3], val);
+    return true;
+  }
+
+  // An older HeaterMeter broadcasting as an IT+ node
   if (nodeId != NODEID_MASTER)
     return false;
 
@@ -275,7 +322,7 @@ static void rfContinueSearch(void)
   if (!rf12_doWork())
     return;
 
-  _recvLast = millis();
+  _recvLast = millis() - _recvAttempt * RF_CMD_RETRY_MS;
   rfSetRecvState(RECVSTATE_CONVERGING);
 }
 
@@ -294,7 +341,8 @@ static void rfReceive(void)
   unsigned long recvTime;
   do {
     recvTime = millis();
-    if (recvTime - wakeTime > (_recvWindow * 2))
+    // Past the window, and the resends of a command that wasn't acked
+    if (recvTime - wakeTime > (_recvWindow * 2) + RF_CMD_RETRIES * RF_CMD_RETRY_MS)
     {
       rf12_sleep(RF12_SLEEP);
 
@@ -323,6 +371,8 @@ static void rfReceive(void)
     }
   } while (!rf12_doWork());
   rf12_sleep(RF12_SLEEP);
+  // A resend came later than the cadence
+  recvTime -= _recvAttempt * RF_CMD_RETRY_MS;
 
   unsigned int newEst = (recvTime - _recvLast) / (_recvLost + 1);
   if (_recvState == RECVSTATE_LOCKED)
@@ -388,6 +438,40 @@ static void transmitTemp(unsigned char pin)
   rf12_sendWait(SLEEPMODE_TX);
 }
 
+// Every enabled pin in one packet, see rf12_multi_t in rfmanager.h
+static void transmitTemps(void)
+{
+  unsigned char outbuf[RF12_MULTI_LEN - 1];
+  unsigned char nodeId = _rfNodeBaseId;
+  memset(outbuf, 0, sizeof(outbuf));
+  outbuf[0] = (RF_PKT_MULTI << 4) | ((nodeId & 0x3f) >> 2);
+  outbuf[1] = ((nodeId & 0x3f) << 6) | (_isRecent ? MULTI_RECENT_BOOT : 0) |
+    (_isBattLow ? MULTI_BATTERY_LOW : 0);
+  outbuf[2] = _enabledProbePins & 0x3f;
+
+  for (unsigned char pin=0; pin < RF_PINS_PER_SOURCE; ++pin)
+  {
+    if (PIN_DISABLED(pin))
+      continue;
+    unsigned int val = _previousReads[pin];
+    val <<= (12 - (10 + TEMP_OVERSAMPLE_BITS));
+    unsigned char *v = &outbuf[3 + (pin / 2) * 3];
+    if (pin & 1)
+    {
+      v[1] |= val >> 8;
+      v[2] = val & 0xff;
+    }
+    else
+    {
+      v[0] = val >> 4;
+      v[1] = (val & 0x0f) << 4;
+    }
+  }
+
+  rf12_sendStart(outbuf, sizeof(outbuf));
+  rf12_sendWait(SLEEPMODE_TX);
+}
+
 static void newTempsAvailable(void)
 {
   // Enable the transmitter because it takes 1-5ms to turn on (3ms in my testing)
@@ -402,14 +486,14 @@ static void newTempsAvailable(void)
     _isRecent = 0;
   }
 
-  boolean hasTransmitted = false;
-  for (unsigned char pin=0; pin < RF_PINS_PER_SOURCE; ++pin)
+  // More than one pin goes in a single packet, the radio is only up once
+  if (_enabledProbePins & (_enabledProbePins - 1))
+    transmitTemps();
+  else
   {
-    if (PIN_DISABLED(pin))
-      continue;
-    if (hasTransmitted) sleep(16);
-    transmitTemp(pin);
-    hasTransmitted = true;
+    for (unsigned char pin=0; pin < RF_PINS_PER_SOURCE; ++pin)
+      if (!PIN_DISABLED(pin))
+        transmitTemp(pin);
   }
   
   rf12_sleep(RF12_SLEEP);
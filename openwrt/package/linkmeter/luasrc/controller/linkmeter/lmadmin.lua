@@ -184,8 +184,16 @@ function action_set()
 
   http.prepare_content("text/plain")
   http.write("User %s setting %d values...\n" % {dsp.context.authuser, cnt})
+  -- Several values go in one config transaction so HeaterMeter writes its
+  -- EEPROM and reports the config once, at the end
+  local txn = cnt > 1
+  local err
+  if txn then
+    err = select(2, lm:query("$LMST,cfg,1", true))
+  end
   local firstTime = true
   for k,v in pairs(vals) do
+    if err then break end
     -- Pause 100ms between commands to allow HeaterMeter to work
     if firstTime then
       firstTime = nil
@@ -193,9 +201,15 @@ function action_set()
       nixio.nanosleep(0, 100000000)
     end
 
-    local result, err = lm:query("$LMST,%s,%s" % {k,v}, true)
+    local result
+    result, err = lm:query("$LMST,%s,%s" % {k,v}, true)
     http.write("%s to %s = %s\n" % {k,v, result or err})
-    if err then break end
+  end
+  -- Left open on an error, HeaterMeter discards it after 10 seconds
+  if txn and not err then
+    local result
+    result, err = lm:query("$LMST,cfg,0", true)
+    http.write("commit = %s\n" % {result or err})
   end
   lm:close()
   http.write("Done!")
@@ -5,6 +5,8 @@ local nixio = require "nixio"
       nixio.util = require "nixio.util" 
 local uci = require "uci"
 local lucid = require "luci.lucid"
+-- Optional, without it the HeaterMeter is left in text mode
+local lmbinOk, lmbin = pcall(require, "lmbin")
 
 local pairs, ipairs, table, pcall, type = pairs, ipairs, table, pcall, type
 local tonumber, tostring, print, next = tonumber, tostring, print, next
@@ -23,6 +25,8 @@ local unkProbe
 
 local rfMap = {}
 local rfStatus = {}
+-- Output command delivery to each lmremote, from $HMRC
+local rfControl = {}
 local hmAlarms = {}
 local hmConfig
 
@@ -195,6 +199,18 @@ local function segPidInternals(line)
   lastPidInternals = line
   broadcastStatus(stsPidInternals)
 end
+
+local lastAutotune
+local function stsAutotune()
+  local vals = segSplit(lastAutotune)
+  return ('event: autotune\ndata: {"s":%s,"c":%s,"t":%s,"ku":%s,"pu":%s}\n\n')
+    :format(vals[1], vals[2], vals[3], vals[4] or "null", vals[5] or "null")
+end
+
+local function segAutotune(line)
+  lastAutotune = line
+  broadcastStatus(stsAutotune)
+end
           
 local function segConfig(line, names, numeric)
   local vals = segSplit(line)
@@ -212,6 +228,14 @@ local function segConfig(line, names, numeric)
   return vals
 end
 
+local function segCookProgram(line)
+  hmConfig.cp = table.concat(segSplit(line), ",")
+end
+
+local function segCookStatus(line)
+  return segConfig(line, {"cps", "cpn", "cpm"}, true)
+end
+
 local function segProbeNames(line)
   local vals = segConfig(line, {"pn0", "pn1", "pn2", "pn3"})
  
@@ -224,6 +248,27 @@ local function segProbeOffsets(line)
   return segConfig(line, {"po0", "po1", "po2", "po3"}, true)
 end
 
+local function segProbeFilters(line)
+  return segConfig(line, {"pf0", "pf1", "pf2", "pf3"}, true)
+end
+
+-- Logged when the stack has come this close to the heap, bytes
+local MEM_STACK_WARN = 64
+local function segMemStats(line)
+  local lastFree = hmConfig.msfree
+  local vals = segConfig(line, {"mdata", "mbss", "mheap", "mfree", "msfree", "msdepth"}, true)
+  local stackFree = hmConfig.msfree
+  if stackFree and stackFree < MEM_STACK_WARN and stackFree ~= lastFree then
+    nixio.syslog("warning", ("HeaterMeter stack within %d bytes of the heap (depth %d)")
+      :format(stackFree, hmConfig.msdepth or 0))
+  end
+  return vals
+end
+
+local function segProbeRejects(line)
+  return segConfig(line, {"prej0", "prej1", "prej2", "prej3"}, true)
+end
+
 local function segPidParams(line)
   return segConfig(line, {"pidb", "pidp", "pidi", "pidd"}, true)
 end
@@ -233,7 +278,7 @@ local function segLidParams(line)
 end
 
 local function segFanParams(line)
-  return segConfig(line, {"fmin", "fmax", "smin", "smax", "oflag"}, true)
+  return segConfig(line, {"fmin", "fmax", "smin", "smax", "oflag", "sstep"}, true)
 end
 
 local function segProbeCoeffs(line)
@@ -248,25 +293,50 @@ end
 local function segRfUpdate(line)
   local vals = segSplit(line)
   rfStatus = {}  -- clear the table to remove stales
-  local idx = 1
   --local now = os.time()
   local band = nixio.bit.band
-  while (idx < #vals) do
+  -- The manager's own entry is 255,RxOverflows,CrcOk
+  if vals[1] == "255" then
+    hmConfig.rfovf = tonumber(vals[2])
+    rfStatus["255"] = { lobatt = 0, reset = 0, native = 0, rssi = vals[3] }
+  end
+  -- Then Id,Flags,Rssi,RssiAvg,Received,Missed,CrcErrors,MaxGap per source
+  local idx = 4
+  while (idx + 7 <= #vals) do
     local nodeId = vals[idx]
     local flags = tonumber(vals[idx+1])
     rfStatus[nodeId] = {
       lobatt = band(flags, 0x01) == 0 and 0 or 1,
       reset = band(flags, 0x02) == 0 and 0 or 1,
       native = band(flags, 0x04) == 0 and 0 or 1,
-      rssi = vals[idx+2]
+      rssi = vals[idx+2],
+      rssiavg = tonumber(vals[idx+3]),
+      rx = tonumber(vals[idx+4]),
+      miss = tonumber(vals[idx+5]),
+      crcerr = tonumber(vals[idx+6]),
+      maxgap = tonumber(vals[idx+7])
     }
     
-    -- If this isn't the NONE source, save the stats as the ANY source
-    if nodeId ~= "255" then
-      rfStatus["127"] = rfStatus[nodeId]
-    end
+    -- Save the stats as the ANY source too
+    rfStatus["127"] = rfStatus[nodeId]
     
-    idx = idx + 3
+    idx = idx + 8
+  end
+end
+
+-- Id,Sent,Failed,Retries,Latency,WorstLatency,Rssi per remote
+local function segRfControl(line)
+  local vals = segSplit(line)
+  rfControl = {}
+  for idx = 1, #vals - 6, 7 do
+    rfControl[vals[idx]] = {
+      sent = tonumber(vals[idx+1]),
+      failed = tonumber(vals[idx+2]),
+      retries = tonumber(vals[idx+3]),
+      latency = tonumber(vals[idx+4]),
+      worst = tonumber(vals[idx+5]),
+      rssi = tonumber(vals[idx+6])
+    }
   end
 end
 
@@ -279,11 +349,20 @@ local function segRfMap(line)
   end
 end
 
-local function segUcIdentifier(line)
+local function segSerialMode(line)
+  return segConfig(line, {"sm", "txo"}, true)
+end
+
+-- loop avg/worst/jitter then worst/avg/overruns for each task, in us
+local function segTaskStats(line)
+  local names = {"tsla", "tslw", "tslj"}
   local vals = segSplit(line)
-  if #vals > 1 then
-    hmConfig.ucid = vals[2]
+  for i = 1, math.floor((#vals - 3) / 3) do
+    names[#names+1] = "ts" .. i .. "w"
+    names[#names+1] = "ts" .. i .. "a"
+    names[#names+1] = "ts" .. i .. "o"
   end
+  return segConfig(line, names, true)
 end
 
 local function setStateUpdateUnk(vals)
@@ -388,8 +467,131 @@ local function throttleUpdate(line)
   skippedUpdates = 0
 end
 
+-- Set from $HMHI while the /history samples are arriving
+local historyBackfill
+-- Give up on a backfill whose last sample never came, seconds
+local HISTORY_BACKFILL_TIMEOUT = 30
+
+-- Ends the backfill and writes the live updates that arrived during it,
+-- all of which are newer than any backfilled sample
+local function historyFlush()
+  local hb = historyBackfill
+  if not hb then return end
+  historyBackfill = nil
+  for _, row in ipairs(hb.pending) do
+    local status, err = pcall(rrd.update, RRD_FILE, row)
+    if not status then nixio.syslog("err", "RRD error: " .. err) end
+  end
+end
+
+local function segHistoryInfo(line)
+  historyFlush()
+  local vals = segSplit(line)
+  if #vals < 3 or tonumber(vals[2]) == 0 then
+    return
+  end
+  -- Samples older than what the RRD already has are skipped
+  local status, last = pcall(rrd.last, RRD_FILE)
+  historyBackfill = {
+    time = os.time(),
+    newest = tonumber(vals[1]),
+    period = tonumber(vals[3]),
+    last = status and tonumber(last) or 0,
+    pending = {}
+  }
+end
+
+local function segHistorySample(line)
+  local hb = historyBackfill
+  if not hb then return end
+  local vals = segSplit(line)
+  if #vals ~= 7 then return end
+
+  -- Sequence numbers are 16-bit and the newest is 0 samples old
+  local age = (hb.newest - tonumber(vals[1])) % 65536
+  local time = hb.time - age * hb.period
+  if time > hb.last and time < hb.time then
+    vals[1] = time
+    local status, err = pcall(rrd.update, RRD_FILE, table.concat(vals, ":"))
+    if not status then nixio.syslog("err", "RRD backfill error: " .. err) end
+    hb.last = time
+  end
+  if age == 0 then
+    historyFlush()
+    nixio.syslog("info", "RRD backfill from HeaterMeter history done")
+  end
+end
+
+-- Sample id of the last $HMSU, to count what went missing in between
+local lastSampleId
+-- Fields of the last $HMSU, without the id, that a $HMSD leaves blank
+local lastStatusFields
+-- Set by $HMSB, the HeaterMeter only sends a status when it changes
+local statusSubscribed
+
+local function countStat(name)
+  if hmConfig then hmConfig[name] = (hmConfig[name] or 0) + 1 end
+end
+
+-- srx = status lines received, sgap = sample ids never received,
+-- sdup = repeated or out of order ids, stdup = discarded for a repeated
+-- timestamp, sthr = skipped by the throttle. cerr counts checksum failures.
+local function checkSampleId(id)
+  if lastSampleId then
+    local delta = (id - lastSampleId) % 65536
+    if delta == 0 or delta > 65536 - 16 then
+      countStat("sdup")
+      return false
+    elseif delta < 32768 then
+      -- Subscribed, a skipped id is a period where nothing changed
+      if hmConfig and not statusSubscribed then
+        hmConfig.sgap = (hmConfig.sgap or 0) + delta - 1
+      end
+    end
+    -- Further back with no $UCID in between, the banner was lost, just
+    -- follow the new ids
+  end
+  lastSampleId = id
+  countStat("srx")
+  return true
+end
+
+-- Status frames and the subscription, both forgotten by a HeaterMeter reset
+local function hmSubscribe()
+  -- Binary status frames are decoded back to lines by lmbin
+  if lmbinOk then serialPolle.fd:write("/set?sm=1\n") end
+  -- A status when it changes, or a keyframe every 10 periods to stay
+  -- inside the RRD heartbeat, RF every 32
+  serialPolle.fd:write("/set?sb=1,1,32,10\n")
+end
+
+-- Sent at boot and in reply to /config. Either way the sample ids may
+-- have started over, so they aren't compared across it
+local function segUcIdentifier(line)
+  local vals = segSplit(line)
+  if #vals > 1 then
+    hmConfig.ucid = vals[2]
+  end
+  lastSampleId = nil
+  lastStatusFields = nil
+  statusSubscribed = nil
+  hmSubscribe()
+end
+
 local function segStateUpdate(line)
-    if throttleUpdate(line) then return end
+    -- The sample id is checked before the throttle, which has to see
+    -- lines without it or no two would ever match
+    if #segSplit(line) == 9 then
+      local body, id = line:match("^(.*),(%d+)$")
+      if not body then return end
+      if not checkSampleId(tonumber(id)) then return end
+      line = body
+      lastStatusFields = segSplit(body)
+    end
+    if throttleUpdate(line) then
+      countStat("sthr")
+      return
+    end
     local vals = segSplit(line)
 
     if #vals == 8 then
@@ -405,6 +607,7 @@ local function segStateUpdate(line)
         rrdCreate()
       elseif time == lastHmUpdate then
         -- RRD hates it when you try to insert two PDPs at the same timestamp
+        countStat("stdup")
         return nixio.syslog("info", "Discarding duplicate update")
       end
       lastHmUpdate = time
@@ -426,9 +629,18 @@ local function segStateUpdate(line)
 
       -- update() can throw an error if you try to insert something it
       -- doesn't like, which will take down the whole server, so just
-      -- ignore any error
-      local status, err = pcall(rrd.update, RRD_FILE, table.concat(vals, ":"))
-      if not status then nixio.syslog("err", "RRD error: " .. err) end
+      -- ignore any error. While the history is backfilling the RRD can't
+      -- take anything newer than the sample being filled, so the update
+      -- waits for historyFlush().
+      if historyBackfill and time - historyBackfill.time > HISTORY_BACKFILL_TIMEOUT then
+        historyFlush()
+      end
+      if historyBackfill then
+        table.insert(historyBackfill.pending, table.concat(vals, ":"))
+      else
+        local status, err = pcall(rrd.update, RRD_FILE, table.concat(vals, ":"))
+        if not status then nixio.syslog("err", "RRD error: " .. err) end
+      end
       
       broadcastStatus(stsLmStateUpdate)
       if lastIp == nil or time - lastIpCheck > 60 then
@@ -439,6 +651,21 @@ local function segStateUpdate(line)
     end
 end
 
+-- Only the fields that changed are sent, the rest are blank
+local function segStatusDelta(line)
+  local vals = segSplit(line)
+  if #vals ~= 9 or not lastStatusFields then return end
+  for i = 1, 8 do
+    if vals[i] == "" then vals[i] = lastStatusFields[i] end
+  end
+  return segStateUpdate("$HMSU," .. table.concat(vals, ","))
+end
+
+local function segStatusSubscription(line)
+  statusSubscribed = true
+  return segConfig(line, {"sbs", "sbp", "sbr", "sbk"})
+end
+
 local function broadcastAlarm(probeIdx, alarmType, thresh)
   local curTemp = JSON_TEMPLATE[15+(probeIdx*11)]
   local pname = JSON_TEMPLATE[13+(probeIdx*11)]
@@ -533,6 +760,9 @@ local function serialHandler(polle)
       if hmConfig == nil then 
         hmConfig = {}
         serialPolle.fd:write("\n/config\n")
+        -- Fill any gap in the RRD from while we weren't listening
+        serialPolle.fd:write("/history\n")
+        hmSubscribe()
       end
  
       -- Remove the checksum of it was there
@@ -560,6 +790,7 @@ local function initHmVars()
   lastIpCheck = 0
   rfMap = {}
   rfStatus = {}
+  rfControl = {}
   hmAlarms = {}
   JSON_TEMPLATE = {}
   for _,v in pairs(JSON_TEMPLATE_SRC) do
@@ -568,6 +799,28 @@ local function initHmVars()
   unthrottleUpdates()
 end
 
+-- Like nixio's linesource() but passes the data through lmbin.split() so
+-- binary frames come out as the text lines they replace
+local function binLineSource(fd)
+  local pending = ""
+  local lines = {}
+  local idx = 1
+  return function()
+    while idx > #lines do
+      local data = fd:read(256)
+      if not data or #data == 0 then return nil end
+      local errors
+      lines, pending, errors = lmbin.split(pending .. data)
+      idx = 1
+      if errors > 0 and hmConfig then
+        hmConfig.cerr = (hmConfig.cerr or 0) + errors
+      end
+    end
+    idx = idx + 1
+    return lines[idx - 1]
+  end
+end
+
 local function lmdStart()
   if serialPolle then return true end
   local cfg = uci.cursor()
@@ -597,7 +850,7 @@ local function lmdStart()
 
   serialPolle = {
     fd = serialfd,
-    lines = serialfd:linesource(),
+    lines = lmbinOk and binLineSource(serialfd) or serialfd:linesource(),
     events = nixio.poll_flags("in"),
     handler = serialHandler
   }
@@ -644,6 +897,14 @@ local function segLmGet(line)
   return table.concat(retVal, '\n')
 end
 
+-- The "ctl" member of an $LMRF entry if the id is an lmremote with outputs
+local function rfControlJson(id)
+  local c = rfControl[id]
+  if not c then return "" end
+  return (',"ctl":{"sent":%d,"failed":%d,"retries":%d,"lat":%d,"latw":%d,"rssi":%d}'):format(
+    c.sent, c.failed, c.retries, c.latency, c.worst, c.rssi)
+end
+
 local function segLmRfStatus(line)
   local retVal = ""
   for id, item in pairs(rfStatus) do
@@ -651,9 +912,22 @@ local function segLmRfStatus(line)
       retVal = retVal .. ","
     end
     
+    -- Link quality, loss is the percent of expected packets missed
+    local rx, miss = item.rx or 0, item.miss or 0
+    local loss = (rx + miss > 0) and (miss * 100 / (rx + miss)) or 0
     retVal = retVal ..
-      ('{"id":%s,"lobatt":%d,"rssi":%d,"reset":%d,"native":%d}'):format(
-      id, item.lobatt, item.rssi, item.reset, item.native)
+      ('{"id":%s,"lobatt":%d,"rssi":%d,"reset":%d,"native":%d,' ..
+      '"rssiavg":%.2f,"rx":%d,"miss":%d,"loss":%.1f,"crcerr":%d,"maxgap":%d'):format(
+      id, item.lobatt, item.rssi, item.reset, item.native,
+      item.rssiavg or item.rssi, rx, miss, loss, item.crcerr or 0,
+      item.maxgap or 0) .. rfControlJson(id) .. "}"
+  end
+  -- Output only remotes send no readings of their own
+  for id in pairs(rfControl) do
+    if not rfStatus[id] then
+      if retVal ~= "" then retVal = retVal .. "," end
+      retVal = retVal .. ('{"id":%s'):format(id) .. rfControlJson(id) .. "}"
+    end
   end
   retVal = "[" .. retVal .. "]"
   
@@ -797,18 +1071,31 @@ end
 
 local segmentMap = {
   ["$HMAL"] = segAlarmLimits,
+  ["$HMAT"] = segAutotune,
+  ["$HMCP"] = segCookProgram,
+  ["$HMCS"] = segCookStatus,
   ["$HMFN"] = segFanParams,
+  ["$HMHI"] = segHistoryInfo,
+  ["$HMHS"] = segHistorySample,
   ["$HMLB"] = segLcdBacklight,
   ["$HMLD"] = segLidParams,
   ["$HMLG"] = segLogMessage,
+  ["$HMMS"] = segMemStats,
   ["$HMPC"] = segProbeCoeffs,
   ["$HMPD"] = segPidParams,
+  ["$HMPF"] = segProbeFilters,
   ["$HMPN"] = segProbeNames,
   ["$HMPO"] = segProbeOffsets,
+  ["$HMPR"] = segProbeRejects,
   ["$HMPS"] = segPidInternals,
+  ["$HMRC"] = segRfControl,
   ["$HMRF"] = segRfUpdate,
   ["$HMRM"] = segRfMap,
+  ["$HMSB"] = segStatusSubscription,
+  ["$HMSD"] = segStatusDelta,
+  ["$HMSM"] = segSerialMode,
   ["$HMSU"] = segStateUpdate,
+  ["$HMTS"] = segTaskStats,
   ["$UCID"] = segUcIdentifier,
 
   ["$LMAT"] = segLmAlarmTest,
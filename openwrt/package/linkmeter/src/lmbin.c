@@ -0,0 +1,196 @@
+/* HeaterMeter Copyright 2013 Bryan Mayland <bmayland@capnbry.net>
+ * Lua module to split the HeaterMeter serial stream into lines, decoding
+ * the binary frames back into the $HM text segments they replace.
+ * See serialxor.h in the firmware for the frame format.
+ *
+ * lines, rest, errors = lmbin.split(buf)
+ *   lines is a table of complete segment lines with no newline, rest is
+ *   the unprocessed tail to prepend to the next read and errors is the
+ *   count of binary frames that failed their CRC or length check.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+
+#define FRAME_MAX     64
+#define LINE_MAX      128
+/* Don't hold more than this waiting on a newline or frame end */
+#define PENDING_MAX   512
+
+#define REC_STATUS    'S'
+#define REC_PIDINT    'P'
+#define TEMP_NONE     INT32_MIN
+
+static uint16_t crc_ccitt_update(uint16_t crc, uint8_t data)
+{
+  data ^= crc & 0xff;
+  data ^= data << 4;
+  return ((((uint16_t)data << 8) | (crc >> 8)) ^ (uint8_t)(data >> 4)
+    ^ ((uint16_t)data << 3));
+}
+
+/* Returns the decoded length or -1 if it doesn't fit in dst */
+static int cobs_decode(const uint8_t *src, size_t len, uint8_t *dst, size_t dstlen)
+{
+  const uint8_t *end = src + len;
+  size_t n = 0;
+  while (src < end)
+  {
+    uint8_t code = *src++;
+    if (code == 0 || src + code - 1 > end || n + code > dstlen)
+      return -1;
+    memcpy(&dst[n], src, code - 1);
+    n += code - 1;
+    src += code - 1;
+    /* Every run but the last ends in an implied zero */
+    if (src < end && code < 0xff)
+      dst[n++] = 0;
+  }
+  return n;
+}
+
+static int get_s16(const uint8_t *p)
+{
+  return (int16_t)(p[0] | (p[1] << 8));
+}
+
+static unsigned int get_u16(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static long get_s32(const uint8_t *p)
+{
+  return (int32_t)(p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+/* Records are little endian which the router may not be */
+static float get_float(const uint8_t *p)
+{
+  uint32_t u = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+  float f;
+  memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+static int fmt_temp(char *out, size_t len, long t)
+{
+  if (t == TEMP_NONE)
+    return snprintf(out, len, ",U");
+  return snprintf(out, len, ",%s%ld.%ld", t < 0 ? "-" : "", labs(t) / 10, labs(t) % 10);
+}
+
+/* Returns the length of the text line or 0 if the record is bad */
+static int record_to_line(const uint8_t *rec, int len, char *line)
+{
+  int i, n = 0;
+  switch (rec[0])
+  {
+    case REC_STATUS:
+      if (len != 25)
+        return 0;
+      n = snprintf(line, LINE_MAX, "$HMSU,%d", get_s16(&rec[1]));
+      for (i=0; i<4; ++i)
+        n += fmt_temp(&line[n], LINE_MAX - n, get_s32(&rec[3 + i * 4]));
+      n += snprintf(&line[n], LINE_MAX - n, ",%u,%u,%u,%u", rec[19], rec[20],
+        get_u16(&rec[21]), get_u16(&rec[23]));
+      break;
+    case REC_PIDINT:
+      if (len != 21)
+        return 0;
+      n = snprintf(line, LINE_MAX, "$HMPS,%.2f,%.2f,%.2f,%.2f,%.2f",
+        get_float(&rec[1]), get_float(&rec[5]), get_float(&rec[9]),
+        get_float(&rec[13]), get_float(&rec[17]));
+      break;
+  }
+  return (n < LINE_MAX) ? n : 0;
+}
+
+static int frame_to_line(const uint8_t *frame, size_t len, char *line)
+{
+  uint8_t rec[FRAME_MAX];
+  uint16_t crc = 0xffff;
+  int i, n = cobs_decode(frame, len, rec, sizeof(rec));
+  if (n < 3)
+    return 0;
+  n -= 2;
+  for (i=0; i<n; ++i)
+    crc = crc_ccitt_update(crc, rec[i]);
+  if (crc != get_u16(&rec[n]))
+    return 0;
+  return record_to_line(rec, n, line);
+}
+
+static int lmbin_split(lua_State *L)
+{
+  size_t len;
+  const uint8_t *p = (const uint8_t *)luaL_checklstring(L, 1, &len);
+  const uint8_t *end = p + len;
+  char line[LINE_MAX];
+  int lines = 0, errors = 0;
+
+  lua_newtable(L);
+  while (p < end)
+  {
+    if (*p == 0)
+    {
+      int n;
+      const uint8_t *fe = memchr(p + 1, 0, end - p - 1);
+      if (fe == NULL)
+        break;
+      /* Two zeros in a row mean the first was the end of a frame that was
+         missed, start over from the second */
+      if (fe == p + 1)
+      {
+        p = fe;
+        continue;
+      }
+      n = frame_to_line(p + 1, fe - p - 1, line);
+      if (n)
+      {
+        lua_pushlstring(L, line, n);
+        lua_rawseti(L, -2, ++lines);
+      }
+      else
+        ++errors;
+      p = fe + 1;
+    }
+    else
+    {
+      const uint8_t *le = p;
+      while (le < end && *le != '\n' && *le != 0)
+        ++le;
+      if (le == end)
+        break;
+      /* A partial line followed by a frame is dropped */
+      if (*le == '\n')
+      {
+        lua_pushlstring(L, (const char *)p, le - p);
+        lua_rawseti(L, -2, ++lines);
+        ++le;
+      }
+      p = le;
+    }
+  }
+
+  if (end - p > PENDING_MAX)
+    p = end;
+  lua_pushlstring(L, (const char *)p, end - p);
+  lua_pushinteger(L, errors);
+  return 3;
+}
+
+static const luaL_reg lmbin_funcs[] = {
+  { "split", lmbin_split },
+  { NULL, NULL }
+};
+
+int luaopen_lmbin(lua_State *L)
+{
+  luaL_register(L, "lmbin", lmbin_funcs);
+  return 1;
+}